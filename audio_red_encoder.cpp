@@ -0,0 +1,104 @@
+#include "audio_red_encoder.h"
+
+#include <cstring>
+
+#include "byte_buffer.h"
+#include "rtp_packet.h"
+#include "spdlog/spdlog.h"
+
+AudioRedEncoder::AudioRedEncoder(uint8_t red_payload_type)
+    : red_payload_type_{red_payload_type} {}
+
+void AudioRedEncoder::SetFractionLost(uint8_t fraction_lost) {
+  size_t redundancy = redundancy_;
+  if (fraction_lost >= kHighFractionLost)
+    redundancy = 2;
+  else if (fraction_lost >= kEnableFractionLost)
+    redundancy = 1;
+  else if (fraction_lost < kDisableFractionLost)
+    redundancy = 0;
+  else if (redundancy > 1)
+    redundancy = 1;
+  if (redundancy != redundancy_) {
+    spdlog::debug("Audio redundancy {} -> {}.", redundancy_, redundancy);
+    redundancy_ = redundancy;
+  }
+}
+
+void AudioRedEncoder::Encode(PacketBuffer* buffer) {
+  // https://tools.ietf.org/html/rfc2198#section-3
+  //  0                   1                   2                   3
+  //  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |F|   block PT  |  timestamp offset         |   block length    |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // One such header per redundant block, oldest first, then a one byte
+  // header for the primary block and the block data in the same order.
+  uint8_t* data = buffer->Data();
+  size_t size = buffer->Size();
+  // Padding and header extensions are not expected before the pacer.
+  if (size < kRtpHeaderFixedSize || (data[0] & 0x30))
+    return;
+  size_t header_size = kRtpHeaderFixedSize + (data[0] & 0x0f) * 4;
+  if (size < header_size)
+    return;
+  uint8_t payload_type = data[1] & 0x7f;
+  uint32_t timestamp = LoadUInt32BE(data + 4);
+  if (started_ && static_cast<int32_t>(timestamp - last_timestamp_) <= 0)
+    return;
+
+  const Frame* blocks[kMaxRedundancy];
+  size_t block_count = 0;
+  size_t red_header_size = 1;
+  size_t red_data_size = 0;
+  for (size_t i = redundancy_; i-- > 0;) {
+    const Frame& frame = frames_[i];
+    if (!frame.valid || frame.payload_type != payload_type ||
+        timestamp - frame.timestamp > kMaxTimestampOffset)
+      continue;
+    blocks[block_count++] = &frame;
+    red_header_size += 4;
+    red_data_size += frame.size;
+  }
+
+  size_t payload_size = size - header_size;
+  uint8_t* primary = data + header_size;
+  size_t red_size = size + red_header_size + red_data_size;
+  if (block_count > 0 &&
+      red_size + PacketBuffer::kSrtpTrailerSize <= buffer->Capacity()) {
+    primary = data + header_size + red_header_size + red_data_size;
+    memmove(primary, data + header_size, payload_size);
+    uint8_t* red = data + header_size;
+    for (size_t i = 0; i < block_count; ++i) {
+      red[0] = 0x80 | blocks[i]->payload_type;
+      StoreUInt24BE(red + 1, ((timestamp - blocks[i]->timestamp) << 10) |
+                                 blocks[i]->size);
+      red += 4;
+    }
+    *red++ = payload_type;
+    for (size_t i = 0; i < block_count; ++i) {
+      memcpy(red, blocks[i]->data, blocks[i]->size);
+      red += blocks[i]->size;
+    }
+    data[1] = (data[1] & 0x80) | red_payload_type_;
+    buffer->SetSize(red_size);
+  }
+  Remember(payload_type, timestamp, primary, payload_size);
+}
+
+void AudioRedEncoder::Remember(uint8_t payload_type,
+                               uint32_t timestamp,
+                               const uint8_t* data,
+                               size_t size) {
+  started_ = true;
+  last_timestamp_ = timestamp;
+  for (size_t i = kMaxRedundancy - 1; i > 0; --i)
+    frames_[i] = frames_[i - 1];
+  Frame& frame = frames_[0];
+  frame.valid = size <= kMaxBlockSize;
+  frame.payload_type = payload_type;
+  frame.timestamp = timestamp;
+  frame.size = frame.valid ? size : 0;
+  if (frame.valid)
+    memcpy(frame.data, data, size);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "packet_buffer.h"
+
+/**
+ * @brief Adds the previous Opus frames of a viewer to its audio packets as
+ * RFC 2198 redundant blocks.
+ *
+ * Redundancy follows the loss reported by the receiver: none while there is
+ * little, then one and two previous frames, so a lost packet is recovered
+ * from the next ones at the cost of bandwidth only. Runs on the loop of the
+ * transport.
+ */
+class AudioRedEncoder {
+ public:
+  static constexpr size_t kMaxRedundancy = 2;
+
+  explicit AudioRedEncoder(uint8_t red_payload_type);
+
+  // |fraction_lost| of an RTCP report block, in 1/256.
+  void SetFractionLost(uint8_t fraction_lost);
+
+  /**
+   * @brief Remember the frame of |buffer| and turn it into a RED packet
+   * when redundancy is on. Packets older than the last one, like resends,
+   * are left alone.
+   */
+  void Encode(PacketBuffer* buffer);
+
+ private:
+  // 1%, 3% and 10%.
+  static constexpr uint8_t kDisableFractionLost = 3;
+  static constexpr uint8_t kEnableFractionLost = 8;
+  static constexpr uint8_t kHighFractionLost = 26;
+  // Limits of the block length and timestamp offset fields.
+  static constexpr size_t kMaxBlockSize = 1023;
+  static constexpr uint32_t kMaxTimestampOffset = 16383;
+
+  struct Frame {
+    bool valid{false};
+    uint8_t payload_type{0};
+    uint32_t timestamp{0};
+    size_t size{0};
+    uint8_t data[kMaxBlockSize];
+  };
+
+  void Remember(uint8_t payload_type,
+                uint32_t timestamp,
+                const uint8_t* data,
+                size_t size);
+
+  uint8_t red_payload_type_;
+  size_t redundancy_{0};
+  bool started_{false};
+  uint32_t last_timestamp_{0};
+  // Most recent first.
+  Frame frames_[kMaxRedundancy];
+};
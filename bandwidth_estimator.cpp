@@ -0,0 +1,243 @@
+#include "bandwidth_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+BandwidthEstimator::BandwidthEstimator() : sent_packets_(kSentHistorySize) {}
+
+void BandwidthEstimator::OnPacketSent(uint16_t transport_sequence_number,
+                                      size_t size,
+                                      int64_t now_millis) {
+  SentPacket& packet =
+      sent_packets_[transport_sequence_number & (kSentHistorySize - 1)];
+  packet.sequence_number = transport_sequence_number;
+  packet.sent = true;
+  packet.acked = false;
+  packet.lost = false;
+  packet.size = static_cast<uint16_t>(std::min<size_t>(size, UINT16_MAX));
+  packet.send_time_millis = now_millis;
+}
+
+void BandwidthEstimator::OnTransportFeedback(
+    const std::vector<RtcpTransportFeedbackView::PacketResult>& results,
+    int64_t now_millis) {
+  for (auto& result : results) {
+    SentPacket& packet =
+        sent_packets_[result.sequence_number & (kSentHistorySize - 1)];
+    if (!packet.sent || packet.sequence_number != result.sequence_number ||
+        packet.acked)
+      continue;
+
+    // A missing packet is reported again by the next feedback, and may show
+    // up there after all.
+    if (!result.received) {
+      if (!packet.lost) {
+        packet.lost = true;
+        ++loss_window_lost_;
+        ++loss_window_packets_;
+      }
+      continue;
+    }
+    packet.acked = true;
+    if (packet.lost) {
+      if (loss_window_lost_ > 0)
+        --loss_window_lost_;
+    } else {
+      ++loss_window_packets_;
+    }
+    double arrival_millis = result.arrival_time_us / 1000.0;
+    UpdateAckedBitrate(arrival_millis, packet.size);
+    OnPacketArrival(packet, arrival_millis);
+  }
+
+  UpdateDelayBasedBitrate(now_millis);
+  UpdateLossBasedBitrate(now_millis);
+}
+
+uint32_t BandwidthEstimator::GetTargetBitrate() const {
+  double target = std::min(delay_based_bitrate_, loss_based_bitrate_);
+  return static_cast<uint32_t>(std::max<double>(target, kMinBitrate));
+}
+
+void BandwidthEstimator::OnPacketArrival(const SentPacket& packet,
+                                         double arrival_millis) {
+  if (current_group_.valid &&
+      packet.send_time_millis < current_group_.first_send_millis)
+    return;  // Reordered into an earlier group.
+
+  if (!current_group_.valid ||
+      packet.send_time_millis - current_group_.first_send_millis >
+          kGroupSpanMillis) {
+    if (current_group_.valid && previous_group_.valid) {
+      double send_delta = current_group_.last_send_millis -
+                          previous_group_.last_send_millis;
+      double arrival_delta = current_group_.last_arrival_millis -
+                             previous_group_.last_arrival_millis;
+      UpdateTrendline(arrival_delta - send_delta, send_delta,
+                      current_group_.last_arrival_millis,
+                      current_group_.last_send_millis);
+    }
+    previous_group_ = current_group_;
+    current_group_.valid = true;
+    current_group_.first_send_millis = packet.send_time_millis;
+    current_group_.last_arrival_millis = arrival_millis;
+  }
+  current_group_.last_send_millis =
+      std::max(current_group_.last_send_millis, packet.send_time_millis);
+  current_group_.last_arrival_millis =
+      std::max(current_group_.last_arrival_millis, arrival_millis);
+}
+
+void BandwidthEstimator::UpdateTrendline(double delay_delta_millis,
+                                         double send_delta_millis,
+                                         double arrival_millis,
+                                         int64_t now_millis) {
+  ++delta_count_;
+  accumulated_delay_millis_ += delay_delta_millis;
+  smoothed_delay_millis_ =
+      kTrendlineSmoothing * smoothed_delay_millis_ +
+      (1 - kTrendlineSmoothing) * accumulated_delay_millis_;
+  if (first_arrival_millis_ < 0)
+    first_arrival_millis_ = arrival_millis;
+  delay_samples_.emplace_back(arrival_millis - first_arrival_millis_,
+                              smoothed_delay_millis_);
+  if (delay_samples_.size() > kTrendlineWindowSize)
+    delay_samples_.pop_front();
+
+  double trend = previous_trend_;
+  if (delay_samples_.size() == kTrendlineWindowSize)
+    trend = TrendlineSlope();
+  Detect(trend, send_delta_millis, now_millis);
+}
+
+double BandwidthEstimator::TrendlineSlope() const {
+  // Least squares fit of the smoothed delay over the arrival time.
+  double sum_x = 0, sum_y = 0;
+  for (auto& sample : delay_samples_) {
+    sum_x += sample.first;
+    sum_y += sample.second;
+  }
+  double mean_x = sum_x / delay_samples_.size();
+  double mean_y = sum_y / delay_samples_.size();
+  double numerator = 0, denominator = 0;
+  for (auto& sample : delay_samples_) {
+    numerator += (sample.first - mean_x) * (sample.second - mean_y);
+    denominator += (sample.first - mean_x) * (sample.first - mean_x);
+  }
+  if (denominator == 0)
+    return previous_trend_;
+  return numerator / denominator;
+}
+
+void BandwidthEstimator::Detect(double trend,
+                                double send_delta_millis,
+                                int64_t now_millis) {
+  double modified_trend =
+      std::min<size_t>(delta_count_, 60) * trend * kTrendlineGain;
+  if (modified_trend > threshold_) {
+    if (time_over_using_millis_ < 0)
+      time_over_using_millis_ = send_delta_millis / 2;
+    else
+      time_over_using_millis_ += send_delta_millis;
+    ++overuse_count_;
+    if (time_over_using_millis_ > kOverusingTimeMillis && overuse_count_ > 1 &&
+        trend >= previous_trend_) {
+      time_over_using_millis_ = 0;
+      overuse_count_ = 0;
+      usage_ = BandwidthUsage::kOverusing;
+    }
+  } else if (modified_trend < -threshold_) {
+    time_over_using_millis_ = -1;
+    overuse_count_ = 0;
+    usage_ = BandwidthUsage::kUnderusing;
+  } else {
+    time_over_using_millis_ = -1;
+    overuse_count_ = 0;
+    usage_ = BandwidthUsage::kNormal;
+  }
+  previous_trend_ = trend;
+  UpdateThreshold(modified_trend, now_millis);
+}
+
+void BandwidthEstimator::UpdateThreshold(double trend, int64_t now_millis) {
+  if (last_threshold_update_millis_ < 0)
+    last_threshold_update_millis_ = now_millis;
+  double abs_trend = std::fabs(trend);
+  // Do not let a single spike raise the threshold.
+  if (abs_trend > threshold_ + 15) {
+    last_threshold_update_millis_ = now_millis;
+    return;
+  }
+  double k = abs_trend < threshold_ ? 0.039 : 0.0087;
+  int64_t elapsed =
+      std::min<int64_t>(now_millis - last_threshold_update_millis_, 100);
+  threshold_ += k * (abs_trend - threshold_) * elapsed;
+  threshold_ = std::min(std::max(threshold_, 6.0), 600.0);
+  last_threshold_update_millis_ = now_millis;
+}
+
+void BandwidthEstimator::UpdateAckedBitrate(double arrival_millis,
+                                            size_t size) {
+  acked_packets_.emplace_back(arrival_millis, size);
+  acked_bytes_ += size;
+  while (arrival_millis - acked_packets_.front().first > kAckedWindowMillis) {
+    acked_bytes_ -= acked_packets_.front().second;
+    acked_packets_.pop_front();
+  }
+  double span = arrival_millis - acked_packets_.front().first;
+  if (span >= kAckedWindowMillis / 2)
+    acked_bitrate_ = static_cast<uint32_t>(acked_bytes_ * 8 * 1000 / span);
+}
+
+void BandwidthEstimator::UpdateDelayBasedBitrate(int64_t now_millis) {
+  if (last_delay_update_millis_ < 0)
+    last_delay_update_millis_ = now_millis;
+  int64_t elapsed = now_millis - last_delay_update_millis_;
+  last_delay_update_millis_ = now_millis;
+
+  if (usage_ == BandwidthUsage::kOverusing) {
+    // Back off below what actually got through, once per interval so the
+    // queue has time to drain.
+    if (acked_bitrate_ > 0 && (last_decrease_millis_ < 0 ||
+                               now_millis - last_decrease_millis_ > 200)) {
+      delay_based_bitrate_ =
+          std::min(delay_based_bitrate_, 0.85 * acked_bitrate_);
+      last_decrease_millis_ = now_millis;
+    }
+  } else if (usage_ == BandwidthUsage::kNormal) {
+    // Grow by 8% per second, but do not run away from the acked bitrate.
+    delay_based_bitrate_ *=
+        std::pow(1.08, std::min<int64_t>(elapsed, 1000) / 1000.0);
+    if (acked_bitrate_ > 0)
+      delay_based_bitrate_ =
+          std::min(delay_based_bitrate_, 1.5 * acked_bitrate_ + 10000);
+  }
+  // Hold while underusing, the queues are draining.
+  delay_based_bitrate_ =
+      std::min(std::max<double>(delay_based_bitrate_, kMinBitrate),
+               static_cast<double>(kMaxBitrate));
+}
+
+void BandwidthEstimator::UpdateLossBasedBitrate(int64_t now_millis) {
+  if (loss_window_start_millis_ < 0)
+    loss_window_start_millis_ = now_millis;
+  int64_t elapsed = now_millis - loss_window_start_millis_;
+  if (elapsed < kLossWindowMillis ||
+      loss_window_packets_ < kMinLossWindowPackets)
+    return;
+
+  double loss = static_cast<double>(loss_window_lost_) / loss_window_packets_;
+  if (loss > 0.1)
+    loss_based_bitrate_ *= 1 - 0.5 * loss;
+  else if (loss < 0.02)
+    loss_based_bitrate_ *=
+        std::pow(1.08, std::min<int64_t>(elapsed, 1000) / 1000.0);
+  // Keep it close to the delay based estimate, otherwise it takes a long
+  // time to come down when losses start.
+  loss_based_bitrate_ = std::min(loss_based_bitrate_, delay_based_bitrate_);
+  loss_based_bitrate_ = std::max<double>(loss_based_bitrate_, kMinBitrate);
+
+  loss_window_start_millis_ = now_millis;
+  loss_window_packets_ = 0;
+  loss_window_lost_ = 0;
+}
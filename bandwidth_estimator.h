@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "rtcp_parser.h"
+
+/**
+ * @brief Send side bandwidth estimation from transport-wide feedback.
+ *
+ * The delay based estimate follows the trend of the one way delay variation
+ * between groups of packets sent within a few milliseconds, the loss based
+ * estimate follows the loss ratio of the feedback, and the target is the
+ * lower of the two. Not thread safe, it lives on the loop of its transport.
+ */
+class BandwidthEstimator {
+ public:
+  static constexpr uint32_t kMinBitrate = 100000;
+  static constexpr uint32_t kInitialBitrate = 1000000;
+  static constexpr uint32_t kMaxBitrate = 20000000;
+
+  BandwidthEstimator();
+
+  void OnPacketSent(uint16_t transport_sequence_number,
+                    size_t size,
+                    int64_t now_millis);
+
+  void OnTransportFeedback(
+      const std::vector<RtcpTransportFeedbackView::PacketResult>& results,
+      int64_t now_millis);
+
+  // Bits per second.
+  uint32_t GetTargetBitrate() const;
+
+ private:
+  enum class BandwidthUsage { kNormal, kUnderusing, kOverusing };
+
+  struct SentPacket {
+    uint16_t sequence_number{0};
+    bool sent{false};
+    bool acked{false};
+    bool lost{false};
+    uint16_t size{0};
+    int64_t send_time_millis{0};
+  };
+
+  struct PacketGroup {
+    bool valid{false};
+    int64_t first_send_millis{0};
+    int64_t last_send_millis{0};
+    double last_arrival_millis{0};
+  };
+
+  // A power of two, so a sequence number keeps its slot across wraparound.
+  static constexpr size_t kSentHistorySize = 2048;
+  static constexpr int64_t kGroupSpanMillis = 5;
+  static constexpr size_t kTrendlineWindowSize = 20;
+  static constexpr double kTrendlineSmoothing = 0.9;
+  static constexpr double kTrendlineGain = 4.0;
+  static constexpr double kOverusingTimeMillis = 10.0;
+  static constexpr int64_t kAckedWindowMillis = 500;
+  static constexpr int64_t kLossWindowMillis = 200;
+  static constexpr size_t kMinLossWindowPackets = 20;
+
+  void OnPacketArrival(const SentPacket& packet, double arrival_millis);
+  void UpdateTrendline(double delay_delta_millis,
+                       double send_delta_millis,
+                       double arrival_millis,
+                       int64_t now_millis);
+  double TrendlineSlope() const;
+  void Detect(double trend, double send_delta_millis, int64_t now_millis);
+  void UpdateThreshold(double trend, int64_t now_millis);
+  void UpdateAckedBitrate(double arrival_millis, size_t size);
+  void UpdateDelayBasedBitrate(int64_t now_millis);
+  void UpdateLossBasedBitrate(int64_t now_millis);
+
+  std::vector<SentPacket> sent_packets_;
+
+  PacketGroup current_group_;
+  PacketGroup previous_group_;
+
+  double first_arrival_millis_{-1};
+  double accumulated_delay_millis_{0};
+  double smoothed_delay_millis_{0};
+  size_t delta_count_{0};
+  std::deque<std::pair<double, double>> delay_samples_;
+
+  BandwidthUsage usage_{BandwidthUsage::kNormal};
+  double threshold_{12.5};
+  int64_t last_threshold_update_millis_{-1};
+  double previous_trend_{0};
+  double time_over_using_millis_{-1};
+  int overuse_count_{0};
+
+  std::deque<std::pair<double, size_t>> acked_packets_;
+  size_t acked_bytes_{0};
+  uint32_t acked_bitrate_{0};
+
+  double delay_based_bitrate_{kInitialBitrate};
+  int64_t last_delay_update_millis_{-1};
+  int64_t last_decrease_millis_{-1};
+
+  double loss_based_bitrate_{kInitialBitrate};
+  int64_t loss_window_start_millis_{-1};
+  size_t loss_window_packets_{0};
+  size_t loss_window_lost_{0};
+};
@@ -0,0 +1,157 @@
+// Throughput of the start code finders and of ParseH264Nalus against the
+// scanner it had before, on keyframe and P-frame sized access units. The
+// translation unit is included to reach every variant.
+#include "h264_parser.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+namespace {
+
+// The slice data is random, with emulation prevention like an encoder
+// writes it, so start codes only appear between NAL units.
+void AppendNalu(std::vector<uint8_t>* frame,
+                uint8_t header,
+                size_t size,
+                std::mt19937* random) {
+  const uint8_t start_code[] = {0, 0, 0, 1};
+  frame->insert(frame->end(), start_code, start_code + sizeof(start_code));
+  frame->push_back(header);
+  std::uniform_int_distribution<int> byte(0, 255);
+  size_t zeros = 0;
+  for (size_t i = 1; i < size; ++i) {
+    uint8_t value = byte(*random);
+    // Slice data has far more zero bytes than uniform noise.
+    if (byte(*random) < 32)
+      value = 0;
+    if (zeros >= 2 && value <= 3) {
+      frame->push_back(3);
+      zeros = 0;
+    }
+    frame->push_back(value);
+    zeros = value == 0 ? zeros + 1 : 0;
+  }
+}
+
+std::vector<uint8_t> MakeKeyframe(std::mt19937* random) {
+  std::vector<uint8_t> frame;
+  AppendNalu(&frame, 0x09, 2, random);
+  AppendNalu(&frame, 0x67, 24, random);
+  AppendNalu(&frame, 0x68, 4, random);
+  AppendNalu(&frame, 0x06, 40, random);
+  AppendNalu(&frame, 0x65, 120000, random);
+  return frame;
+}
+
+std::vector<uint8_t> MakePFrame(std::mt19937* random) {
+  std::vector<uint8_t> frame;
+  AppendNalu(&frame, 0x09, 2, random);
+  AppendNalu(&frame, 0x41, 6000, random);
+  return frame;
+}
+
+// ParseH264Nalus before the finders.
+std::vector<H264Nalu> OldParseH264Nalus(const uint8_t* data, size_t size) {
+  std::vector<H264Nalu> nalus;
+  if (size < 3)
+    return nalus;
+
+  const size_t end = size - 3;
+  for (size_t i = 0; i < end;) {
+    if (data[i + 2] > 1) {
+      i += 3;
+    } else if (data[i + 2] == 1) {
+      if (data[i + 1] == 0 && data[i] == 0) {
+        size_t start_offset = i;
+        if (start_offset > 0 && data[start_offset - 1] == 0)
+          --start_offset;
+        if (!nalus.empty())
+          nalus.back().size = start_offset - nalus.back().offset;
+        nalus.push_back({static_cast<uint32_t>(i + 3), 0, 0, 0});
+      }
+      i += 3;
+    } else {
+      ++i;
+    }
+  }
+
+  if (!nalus.empty())
+    nalus.back().size = size - nalus.back().offset;
+  for (auto& nalu : nalus) {
+    if (nalu.size > 0)
+      nalu.type = data[nalu.offset] & kNaluTypeMask;
+  }
+  return nalus;
+}
+
+// Runs |function| over the frame for about |bytes| in total and prints MB/s.
+template <typename Function>
+void Measure(const char* frame_name,
+             const char* name,
+             const std::vector<uint8_t>& frame,
+             size_t bytes,
+             Function function) {
+  size_t iterations = bytes / frame.size() + 1;
+  size_t checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+    checksum += function(frame.data(), frame.size());
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::printf("%-9s %-18s %9.1f MB/s (%zu)\n", frame_name, name,
+              iterations * frame.size() / elapsed.count() / 1e6, checksum);
+}
+
+// Walks the frame with |find| the way ParseH264Nalus does.
+size_t CountStartCodes(FindStartCodeFunction find,
+                       const uint8_t* data,
+                       size_t size) {
+  size_t count = 0;
+  const uint8_t* end = data + size - 1;
+  for (const uint8_t* p = find(data, end); p != end; p = find(p + 3, end))
+    ++count;
+  return count;
+}
+
+void Run(const char* frame_name, const std::vector<uint8_t>& frame) {
+  const size_t kBytes = 500000000;
+  Measure(frame_name, "old parser", frame, kBytes,
+          [](const uint8_t* data, size_t size) {
+            return OldParseH264Nalus(data, size).size();
+          });
+  Measure(frame_name, "parser", frame, kBytes,
+          [](const uint8_t* data, size_t size) {
+            return ParseH264Nalus(data, size).size();
+          });
+  Measure(frame_name, "scalar finder", frame, kBytes,
+          [](const uint8_t* data, size_t size) {
+            return CountStartCodes(&FindStartCodeScalar, data, size);
+          });
+#ifdef H264_PARSER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    Measure(frame_name, "sse2 finder", frame, kBytes,
+            [](const uint8_t* data, size_t size) {
+              return CountStartCodes(&FindStartCodeSse2, data, size);
+            });
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    Measure(frame_name, "avx2 finder", frame, kBytes,
+            [](const uint8_t* data, size_t size) {
+              return CountStartCodes(&FindStartCodeAvx2, data, size);
+            });
+  }
+#endif
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 random(20240611);
+  auto keyframe = MakeKeyframe(&random);
+  auto p_frame = MakePFrame(&random);
+  Run("keyframe", keyframe);
+  Run("p-frame", p_frame);
+  return 0;
+}
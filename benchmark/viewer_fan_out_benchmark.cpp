@@ -0,0 +1,176 @@
+// Packets per second the media source thread hands to its viewers, through
+// one post per packet and viewer as WebrtcTransport used to do, and through
+// the SPSC ring it uses now, where only the first packet of a batch posts a
+// drain. The viewers only count the packets, so this measures the hand-off.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+namespace {
+
+struct Packet {
+  uint8_t payload[1200];
+};
+using PacketPointer = std::shared_ptr<Packet>;
+
+// Like EventLoopPool, viewers share a few loops.
+class EventLoops {
+ public:
+  explicit EventLoops(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      auto context = std::make_unique<boost::asio::io_context>();
+      guards_.emplace_back(context->get_executor());
+      threads_.emplace_back([&io_context = *context]() { io_context.run(); });
+      contexts_.push_back(std::move(context));
+    }
+  }
+
+  ~EventLoops() {
+    for (auto& guard : guards_)
+      guard.reset();
+    for (auto& thread : threads_)
+      thread.join();
+  }
+
+  boost::asio::io_context& Context(size_t index) {
+    return *contexts_[index % contexts_.size()];
+  }
+
+ private:
+  using work_guard_type = boost::asio::executor_work_guard<
+      boost::asio::io_context::executor_type>;
+  std::vector<std::unique_ptr<boost::asio::io_context>> contexts_;
+  std::vector<work_guard_type> guards_;
+  std::vector<std::thread> threads_;
+};
+
+class Viewer : public std::enable_shared_from_this<Viewer> {
+ public:
+  Viewer(boost::asio::io_context& message_loop,
+         size_t queue_size,
+         std::atomic<uint64_t>* delivered)
+      : message_loop_{message_loop},
+        pending_packets_{queue_size},
+        delivered_{delivered} {}
+
+  void PostPacket(PacketPointer packet) {
+    std::weak_ptr<Viewer> weak_self = shared_from_this();
+    message_loop_.post([weak_self, packet]() {
+      auto self = weak_self.lock();
+      if (self)
+        self->OnPacket(packet);
+    });
+  }
+
+  // Same as WebrtcTransport::OnMediaPacketGenerated.
+  bool PushPacket(PacketPointer packet) {
+    if (!pending_packets_.push(packet))
+      return false;
+    if (!delivery_scheduled_.exchange(true)) {
+      std::weak_ptr<Viewer> weak_self = shared_from_this();
+      message_loop_.post([weak_self]() {
+        auto self = weak_self.lock();
+        if (self)
+          self->DeliverPendingPackets();
+      });
+    }
+    return true;
+  }
+
+ private:
+  void DeliverPendingPackets() {
+    delivery_scheduled_ = false;
+    pending_packets_.consume_all(
+        [this](const PacketPointer& packet) { OnPacket(packet); });
+  }
+
+  void OnPacket(const PacketPointer& packet) {
+    checksum_ += packet->payload[0];
+    delivered_->fetch_add(1, std::memory_order_relaxed);
+  }
+
+  boost::asio::io_context& message_loop_;
+  boost::lockfree::spsc_queue<PacketPointer> pending_packets_;
+  std::atomic<bool> delivery_scheduled_{false};
+  std::atomic<uint64_t>* delivered_;
+  uint64_t checksum_{0};
+};
+
+enum class Path { kPostPerPacket, kSpscRing };
+
+// Sends |packets| to every viewer in bursts of |burst| packets, waiting for
+// the viewers to take each burst like a live source waits for the next frame.
+void Run(Path path,
+         size_t loop_count,
+         size_t viewer_count,
+         size_t packets,
+         size_t burst) {
+  const size_t kQueueSize = 512;
+  std::atomic<uint64_t> delivered{0};
+  uint64_t dropped = 0;
+  {
+    EventLoops loops(loop_count);
+    std::vector<std::shared_ptr<Viewer>> viewers;
+    for (size_t i = 0; i < viewer_count; ++i) {
+      viewers.push_back(
+          std::make_shared<Viewer>(loops.Context(i), kQueueSize, &delivered));
+    }
+    auto packet = std::make_shared<Packet>();
+    packet->payload[0] = 1;
+
+    std::chrono::duration<double> fan_out_time{0};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < packets; sent += burst) {
+      auto fan_out_start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < burst; ++i) {
+        for (auto& viewer : viewers) {
+          if (path == Path::kPostPerPacket)
+            viewer->PostPacket(packet);
+          else if (!viewer->PushPacket(packet))
+            ++dropped;
+        }
+      }
+      fan_out_time += std::chrono::steady_clock::now() - fan_out_start;
+      uint64_t expected = (sent + burst) * viewer_count - dropped;
+      while (delivered.load(std::memory_order_relaxed) < expected)
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    double total = static_cast<double>(packets) * viewer_count;
+    std::printf(
+        "%-15s %5zu viewers %9.2f M/s fan-out %9.2f M/s delivered "
+        "%8.1f ns/packet on the source thread, %llu dropped\n",
+        path == Path::kPostPerPacket ? "post-per-packet" : "spsc-ring",
+        viewer_count, total / fan_out_time.count() / 1e6,
+        total / elapsed.count() / 1e6, fan_out_time.count() * 1e9 / total,
+        static_cast<unsigned long long>(dropped));
+  }
+}
+
+}  // namespace
+
+int main() {
+  size_t loop_count = std::thread::hardware_concurrency();
+  if (loop_count > 1)
+    --loop_count;
+  if (loop_count == 0)
+    loop_count = 1;
+  std::printf("%zu event loops\n", loop_count);
+
+  // A burst is about a keyframe, it fits in the ring of every viewer.
+  const size_t kBurst = 256;
+  const size_t kDeliveries = 10000000;
+  for (size_t viewer_count : {1, 10, 100, 1000}) {
+    size_t packets = kDeliveries / viewer_count / kBurst * kBurst;
+    Run(Path::kPostPerPacket, loop_count, viewer_count, packets, kBurst);
+    Run(Path::kSpscRing, loop_count, viewer_count, packets, kBurst);
+  }
+  return 0;
+}
@@ -2,7 +2,9 @@
 
 #include <chrono>
 
+#include "metrics.h"
 #include "spdlog/spdlog.h"
+#include "utils.h"
 
 static const uint32_t kDtlsMtu = 1350;
 
@@ -160,6 +162,7 @@ bool DtlsTransport::Start(const std::string& setup_in_sdp) {
   setup_ == kActive ? SSL_set_connect_state(ssl_) : SSL_set_accept_state(ssl_);
 
   inited_ = true;
+  handshake_start_millis_ = TimeMillis();
   SSL_do_handshake(ssl_);
 
   timer_.reset(new Timer(io_context_, this));
@@ -355,6 +358,11 @@ void DtlsTransport::OnSSLInfo(int where, int ret) {
     spdlog::debug("DTLS handshake start");
   } else if ((where & SSL_CB_HANDSHAKE_DONE) != 0) {
     spdlog::debug("DTLS handshake done");
+    if (handshake_start_millis_ >= 0) {
+      Metrics::GetInstance().dtls_handshake_duration.Observe(
+          TimeMillis() - handshake_start_millis_);
+      handshake_start_millis_ = -1;
+    }
     if (!SetupSRTP())
       listener_->OnDtlsTransportError();
   }
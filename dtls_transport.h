@@ -67,6 +67,8 @@ class DtlsTransport : public Timer::Listener {
   DtlsContext::Hash remote_hash_;
   std::atomic<bool> inited_;
   std::unique_ptr<Timer> timer_;
+  // -1 once the handshake is done.
+  int64_t handshake_start_millis_{-1};
   Observer* listener_;
   static constexpr int kReadBufferSize{65536};
   uint8_t read_buffer_[kReadBufferSize];
@@ -0,0 +1,161 @@
+#include "egress_scheduler.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+#include "utils.h"
+
+EgressScheduler::Flow::Flow(EgressScheduler* scheduler, Sender sender)
+    : scheduler_{scheduler},
+      sender_{std::move(sender)},
+      audio_queue_{kAudioQueueSize},
+      video_queue_{kVideoQueueSize} {}
+
+EgressScheduler::Flow::~Flow() {
+  PacketBuffer* packet = nullptr;
+  while (audio_queue_.pop(packet))
+    PacketBuffer::Releaser()(packet);
+  while (video_queue_.pop(packet))
+    PacketBuffer::Releaser()(packet);
+}
+
+bool EgressScheduler::Flow::Enqueue(PacketBuffer::Pointer buffer,
+                                    bool is_audio) {
+  auto& queue = is_audio ? audio_queue_ : video_queue_;
+  if (!queue.push(buffer.get())) {
+    dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  buffer.release();
+  if (!active_.exchange(true))
+    scheduler_->Activate(shared_from_this());
+  return true;
+}
+
+uint64_t EgressScheduler::Flow::GetDroppedPackets() const {
+  return dropped_packets_.load(std::memory_order_relaxed);
+}
+
+bool EgressScheduler::Flow::Empty() {
+  return !audio_queue_.read_available() && !video_queue_.read_available();
+}
+
+bool EgressScheduler::Flow::Deactivate() {
+  active_ = false;
+  if (Empty())
+    return true;
+  // A packet was queued after the check. If the transport saw the flag
+  // cleared it activated the flow again, otherwise keep it.
+  return active_.exchange(true);
+}
+
+EgressScheduler& EgressScheduler::GetInstance() {
+  static EgressScheduler egress_scheduler;
+  return egress_scheduler;
+}
+
+void EgressScheduler::Start(uint32_t rate_kbps) {
+  if (rate_kbps == 0 || work_thread_.joinable())
+    return;
+  rate_kbps_ = rate_kbps;
+  timer_.reset(new Timer(message_loop_, this));
+  timer_->AsyncWait(kProcessIntervalMillis);
+  work_thread_ = std::thread([this]() { message_loop_.run(); });
+  spdlog::info("Egress is limited to {} kbps.", rate_kbps);
+}
+
+void EgressScheduler::Stop() {
+  if (!work_thread_.joinable())
+    return;
+  message_loop_.stop();
+  work_thread_.join();
+  timer_.reset();
+  active_flows_.clear();
+  std::lock_guard<std::mutex> guard(mutex_);
+  activated_flows_.clear();
+}
+
+bool EgressScheduler::IsEnabled() const {
+  return rate_kbps_ != 0;
+}
+
+std::shared_ptr<EgressScheduler::Flow> EgressScheduler::CreateFlow(
+    Flow::Sender sender) {
+  return std::shared_ptr<Flow>(new Flow(this, std::move(sender)));
+}
+
+void EgressScheduler::Activate(std::shared_ptr<Flow> flow) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  activated_flows_.push_back(std::move(flow));
+}
+
+void EgressScheduler::OnTimerTimeout() {
+  Process();
+  timer_->AsyncWait(kProcessIntervalMillis);
+}
+
+void EgressScheduler::Process() {
+  int64_t now_millis = TimeMillis();
+  int64_t bytes_per_milli = static_cast<int64_t>(rate_kbps_) / 8;
+  int64_t max_budget = std::max<int64_t>(bytes_per_milli * kMaxBurstMillis,
+                                         PacketBuffer::kMtuSize);
+  if (last_process_millis_ < 0)
+    budget_bytes_ = max_budget;
+  else
+    budget_bytes_ = std::min(
+        budget_bytes_ + bytes_per_milli * (now_millis - last_process_millis_),
+        max_budget);
+  last_process_millis_ = now_millis;
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto& flow : activated_flows_)
+      active_flows_.push_back(std::move(flow));
+    activated_flows_.clear();
+  }
+
+  // Audio has strict priority. It is small, so it is charged to the budget
+  // but never waits for it.
+  PacketBuffer* packet = nullptr;
+  for (auto& flow : active_flows_) {
+    while (flow->audio_queue_.pop(packet))
+      Send(flow.get(), packet);
+  }
+
+  while (budget_bytes_ > 0 && !active_flows_.empty()) {
+    std::shared_ptr<Flow> flow = active_flows_.front();
+    if (!quantum_granted_) {
+      flow->deficit_ += kQuantumBytes;
+      quantum_granted_ = true;
+    }
+    while (budget_bytes_ > 0 && flow->video_queue_.read_available() &&
+           static_cast<int64_t>(flow->video_queue_.front()->Size()) <=
+               flow->deficit_) {
+      flow->video_queue_.pop(packet);
+      flow->deficit_ -= packet->Size();
+      Send(flow.get(), packet);
+    }
+    // Out of budget in the middle of the turn, go on with it next time.
+    if (budget_bytes_ <= 0 && flow->video_queue_.read_available() &&
+        static_cast<int64_t>(flow->video_queue_.front()->Size()) <=
+            flow->deficit_)
+      break;
+
+    quantum_granted_ = false;
+    active_flows_.pop_front();
+    if (flow->video_queue_.read_available()) {
+      active_flows_.push_back(std::move(flow));
+    } else {
+      // An idle flow does not keep its deficit.
+      flow->deficit_ = 0;
+      if (!flow->Deactivate())
+        active_flows_.push_back(std::move(flow));
+    }
+  }
+}
+
+void EgressScheduler::Send(Flow* flow, PacketBuffer* packet) {
+  PacketBuffer::Pointer buffer(packet);
+  budget_bytes_ -= buffer->Size();
+  flow->sender_(std::move(buffer));
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "packet_buffer.h"
+#include "timer.h"
+
+/**
+ * @brief Shares the egress rate of the node between all webrtc transports.
+ *
+ * Every transport feeds a Flow. One thread drains the flows under a token
+ * bucket refilled at the configured total rate: audio of every flow first,
+ * then video with deficit round robin, so a keyframe fanned out to many
+ * viewers leaves interleaved instead of as back to back bursts.
+ */
+class EgressScheduler : public Timer::Listener {
+ public:
+  class Flow : public std::enable_shared_from_this<Flow> {
+   public:
+    // Called on the scheduler thread, must be thread safe.
+    using Sender = std::function<void(PacketBuffer::Pointer buffer)>;
+
+    ~Flow();
+
+    /**
+     * @brief Queue an RTP packet, only called by the thread of the transport.
+     *
+     * @return false if the queue is full and the packet is dropped.
+     */
+    bool Enqueue(PacketBuffer::Pointer buffer, bool is_audio);
+
+    uint64_t GetDroppedPackets() const;
+
+   private:
+    friend class EgressScheduler;
+    Flow(EgressScheduler* scheduler, Sender sender);
+    bool Empty();
+    // Takes the flow off the active list unless packets came in meanwhile.
+    bool Deactivate();
+
+    EgressScheduler* scheduler_;
+    Sender sender_;
+    // Raw pointers, spsc_queue can not hold move-only values.
+    boost::lockfree::spsc_queue<PacketBuffer*> audio_queue_;
+    boost::lockfree::spsc_queue<PacketBuffer*> video_queue_;
+    std::atomic<bool> active_{false};
+    std::atomic<uint64_t> dropped_packets_{0};
+    // Only touched by the scheduler thread.
+    int64_t deficit_{0};
+  };
+
+  static EgressScheduler& GetInstance();
+
+  /**
+   * @brief Start the scheduler thread, nothing is scheduled if |rate_kbps|
+   * is 0.
+   */
+  void Start(uint32_t rate_kbps);
+
+  void Stop();
+
+  bool IsEnabled() const;
+
+  std::shared_ptr<Flow> CreateFlow(Flow::Sender sender);
+
+ private:
+  static constexpr size_t kAudioQueueSize = 256;
+  static constexpr size_t kVideoQueueSize = 2048;
+  static constexpr int64_t kQuantumBytes = PacketBuffer::kMtuSize;
+  static constexpr uint64_t kProcessIntervalMillis = 1;
+  // Budget that may build up while idle.
+  static constexpr int64_t kMaxBurstMillis = 2;
+
+  EgressScheduler() = default;
+  void Activate(std::shared_ptr<Flow> flow);
+  void OnTimerTimeout() override;
+  void Process();
+  void Send(Flow* flow, PacketBuffer* packet);
+
+  boost::asio::io_context message_loop_;
+  std::unique_ptr<Timer> timer_;
+  std::thread work_thread_;
+  uint32_t rate_kbps_{0};
+  int64_t budget_bytes_{0};
+  int64_t last_process_millis_{-1};
+
+  std::mutex mutex_;
+  // Flows that became active since the last round, guarded by |mutex_|.
+  std::vector<std::shared_ptr<Flow>> activated_flows_;
+  // Only touched by the scheduler thread.
+  std::deque<std::shared_ptr<Flow>> active_flows_;
+  // The front flow got its quantum and is still in its turn.
+  bool quantum_granted_{false};
+};
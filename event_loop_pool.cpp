@@ -0,0 +1,73 @@
+#include "event_loop_pool.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+EventLoopPool::EventLoop::EventLoop()
+    : io_context_{1}, work_guard_{io_context_.get_executor()} {}
+
+boost::asio::io_context& EventLoopPool::EventLoop::Context() {
+  return io_context_;
+}
+
+size_t EventLoopPool::EventLoop::Load() const {
+  return load_.load(std::memory_order_relaxed);
+}
+
+EventLoopPool& EventLoopPool::GetInstance() {
+  static EventLoopPool event_loop_pool;
+  return event_loop_pool;
+}
+
+void EventLoopPool::Start(size_t thread_count) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  StartLocked(thread_count);
+}
+
+void EventLoopPool::StartLocked(size_t thread_count) {
+  if (!event_loops_.empty())
+    return;
+  if (thread_count == 0)
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i = 0; i < thread_count; ++i) {
+    std::unique_ptr<EventLoop> event_loop(new EventLoop);
+    EventLoop* loop = event_loop.get();
+    loop->work_thread_ = std::thread([loop]() { loop->io_context_.run(); });
+    event_loops_.push_back(std::move(event_loop));
+  }
+  spdlog::info("Started {} event loops.", thread_count);
+}
+
+void EventLoopPool::Stop() {
+  for (auto& event_loop : event_loops_) {
+    event_loop->work_guard_.reset();
+    event_loop->io_context_.stop();
+  }
+
+  for (auto& event_loop : event_loops_) {
+    if (event_loop->work_thread_.joinable())
+      event_loop->work_thread_.join();
+  }
+}
+
+EventLoopPool::EventLoop* EventLoopPool::Acquire() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (event_loops_.empty()) {
+    spdlog::warn("Event loops are not started, start one per core.");
+    StartLocked(0);
+  }
+  EventLoop* least_loaded = event_loops_.front().get();
+  for (auto& event_loop : event_loops_) {
+    if (event_loop->Load() < least_loaded->Load())
+      least_loaded = event_loop.get();
+  }
+  least_loaded->load_.fetch_add(1, std::memory_order_relaxed);
+  return least_loaded;
+}
+
+void EventLoopPool::Release(EventLoop* event_loop) {
+  if (event_loop)
+    event_loop->load_.fetch_sub(1, std::memory_order_relaxed);
+}
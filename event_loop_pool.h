@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+/**
+ * @brief A fixed set of event loops shared by all webrtc transports.
+ *
+ * Every loop is run by exactly one thread, so the handlers of a transport
+ * never run concurrently and need no strand.
+ */
+class EventLoopPool {
+ public:
+  class EventLoop {
+   public:
+    EventLoop();
+    boost::asio::io_context& Context();
+    // Number of transports assigned to this loop.
+    size_t Load() const;
+
+   private:
+    friend class EventLoopPool;
+    using work_guard_type = boost::asio::executor_work_guard<
+        boost::asio::io_context::executor_type>;
+    boost::asio::io_context io_context_;
+    work_guard_type work_guard_;
+    std::thread work_thread_;
+    std::atomic<size_t> load_{0};
+  };
+
+  static EventLoopPool& GetInstance();
+
+  /**
+   * @brief Start |thread_count| loops, one per core if it is 0.
+   */
+  void Start(size_t thread_count);
+
+  void Stop();
+
+  /**
+   * @brief Assign the least loaded loop, give it back with Release. Starts
+   * one loop per core if Start was not called, so it never fails.
+   */
+  EventLoop* Acquire();
+
+  void Release(EventLoop* event_loop);
+
+ private:
+  EventLoopPool() = default;
+  void StartLocked(size_t thread_count);
+  // Guards |event_loops_| between Start and Acquire.
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<EventLoop>> event_loops_;
+};
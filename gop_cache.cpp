@@ -4,6 +4,7 @@ void GopCache::AddPacket(MediaPacket::Pointer pkt) {
   if (!pkt)
     return;
 
+  std::lock_guard<std::mutex> guard(mutex_);
   if (pkt->PacketType() == MediaPacket::Type::kVideo 
     && pkt->IsKey()) {
     cached_packets_.clear();
@@ -12,5 +13,6 @@ void GopCache::AddPacket(MediaPacket::Pointer pkt) {
 }
 
 std::list<MediaPacket::Pointer> GopCache::GetCachedPackets() {
+  std::lock_guard<std::mutex> guard(mutex_);
   return cached_packets_;
 }
\ No newline at end of file
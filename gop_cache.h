@@ -1,14 +1,17 @@
 #pragma once
 
 #include <list>
+#include <mutex>
 
 #include "media_packet.h"
 
+// Thread safe, viewers read it to redeliver the keyframe.
 class GopCache {
  public:
   void AddPacket(MediaPacket::Pointer pkt);
   std::list<MediaPacket::Pointer> GetCachedPackets();
 
  private:
+  std::mutex mutex_;
   std::list<MediaPacket::Pointer> cached_packets_;
 };
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "h264_parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define H264_PARSER_X86 1
+#endif
+
+const uint8_t kNaluTypeMask = 0x1F;
+
+namespace {
+
+using FindStartCodeFunction = const uint8_t* (*)(const uint8_t* begin,
+                                                 const uint8_t* end);
+
+// All finders return the first 00 00 01 that lies completely in
+// [begin, end), or |end|.
+const uint8_t* FindStartCodeScalar(const uint8_t* begin, const uint8_t* end) {
+  const uint8_t* p = begin;
+  while (end - p >= 3) {
+    if (p[2] > 1) {
+      p += 3;
+    } else if (p[2] == 1) {
+      if (p[1] == 0 && p[0] == 0)
+        return p;
+      p += 3;
+    } else {
+      ++p;
+    }
+  }
+  return end;
+}
+
+#ifdef H264_PARSER_X86
+// Compare three overlapping loads, so bit i of the mask is set if a start
+// code begins at byte i of the block.
+const uint8_t* FindStartCodeSse2(const uint8_t* begin, const uint8_t* end) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  const uint8_t* p = begin;
+  while (end - p >= 16 + 2) {
+    __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+    __m128i match = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+        _mm_cmpeq_epi8(b2, one));
+    int mask = _mm_movemask_epi8(match);
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return FindStartCodeScalar(p, end);
+}
+
+__attribute__((target("avx2"))) const uint8_t* FindStartCodeAvx2(
+    const uint8_t* begin,
+    const uint8_t* end) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  const uint8_t* p = begin;
+  while (end - p >= 32 + 2) {
+    __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+    __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+    __m256i match = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                         _mm256_cmpeq_epi8(b1, zero)),
+        _mm256_cmpeq_epi8(b2, one));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return FindStartCodeSse2(p, end);
+}
+#endif
+
+FindStartCodeFunction SelectFindStartCode() {
+#ifdef H264_PARSER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &FindStartCodeAvx2;
+  if (__builtin_cpu_supports("sse2"))
+    return &FindStartCodeSse2;
+#endif
+  return &FindStartCodeScalar;
+}
+
+}  // namespace
+
+const uint8_t* FindH264StartCode(const uint8_t* begin, const uint8_t* end) {
+  static const FindStartCodeFunction find_start_code = SelectFindStartCode();
+  return find_start_code(begin, end);
+}
+
+std::vector<H264Nalu> ParseH264Nalus(const uint8_t* data, size_t size) {
+  std::vector<H264Nalu> nalus;
+  if (size < 3)
+    return nalus;
+
+  // A start code in the last three bytes has no NAL unit after it.
+  const uint8_t* end = data + size - 1;
+  const uint8_t* p = data;
+  while (true) {
+    const uint8_t* start_code = FindH264StartCode(p, end);
+    if (start_code == end)
+      break;
+    // Now check if it was a 3 of 4 byte one.
+    size_t start_offset = start_code - data;
+    if (start_offset > 0 && data[start_offset - 1] == 0)
+      --start_offset;
+
+    // Update length of previous entry.
+    if (!nalus.empty())
+      nalus.back().size = start_offset - nalus.back().offset;
+
+    nalus.push_back({static_cast<uint32_t>(start_code + 3 - data), 0, 0, 0});
+    p = start_code + 3;
+  }
+
+  // Update length of last entry, if any.
+  if (!nalus.empty())
+    nalus.back().size = size - nalus.back().offset;
+
+  for (auto& nalu : nalus) {
+    if (nalu.size > 0) {
+      nalu.type = data[nalu.offset] & kNaluTypeMask;
+      nalu.ref_idc = (data[nalu.offset] >> 5) & 0x03;
+    }
+  }
+  return nalus;
+}
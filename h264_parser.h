@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum H264NaluType : uint8_t {
+  kH264NaluSlice = 1,
+  kH264NaluIdr = 5,
+  kH264NaluSei = 6,
+  kH264NaluSps = 7,
+  kH264NaluPps = 8,
+  kH264NaluAud = 9,
+};
+
+struct H264Nalu {
+  // Offset of the NAL unit header, the start code is not included.
+  uint32_t offset;
+  uint32_t size;
+  uint8_t type;
+  // nal_ref_idc, 0 if no other picture refers to this one.
+  uint8_t ref_idc;
+};
+
+/**
+ * @brief Find the first 00 00 01 that lies completely in [begin, end).
+ *
+ * Uses AVX2 or SSE2 when the CPU has it.
+ *
+ * @return Start of the start code, or |end| if there is none.
+ */
+const uint8_t* FindH264StartCode(const uint8_t* begin, const uint8_t* end);
+
+/**
+ * @brief Find the NAL units of an Annex-B frame.
+ */
+std::vector<H264Nalu> ParseH264Nalus(const uint8_t* data, size_t size);
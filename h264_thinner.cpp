@@ -0,0 +1,115 @@
+#include "h264_thinner.h"
+
+#include <algorithm>
+
+#include "h264_parser.h"
+#include "spdlog/spdlog.h"
+
+bool H264Thinner::Filter(const MediaPacket& packet, int64_t now_millis) {
+  bool has_slice = false;
+  bool is_reference = false;
+  for (auto& nalu : packet.Nalus()) {
+    if (nalu.type == kH264NaluSlice || nalu.type == kH264NaluIdr) {
+      has_slice = true;
+      is_reference |= nalu.ref_idc != 0;
+    }
+  }
+
+  if (window_start_millis_ < 0)
+    window_start_millis_ = now_millis;
+  if (packet.IsKey())
+    key_bytes_ += packet.Size();
+  else if (is_reference)
+    reference_bytes_ += packet.Size();
+  else
+    non_reference_bytes_ += packet.Size();
+  if (now_millis - window_start_millis_ >= kWindowMillis)
+    UpdateLevel(now_millis);
+
+  // Parameter sets and SEI alone are not frames, always send them.
+  if (!has_slice)
+    return true;
+
+  bool send = true;
+  if (packet.IsKey()) {
+    waiting_for_keyframe_ = false;
+  } else if (waiting_for_keyframe_) {
+    send = false;
+  } else if (level_ == Level::kKeyframesOnly) {
+    send = false;
+    waiting_for_keyframe_ = is_reference;
+  } else if (level_ == Level::kDropNonReference && !is_reference) {
+    send = false;
+  }
+
+  if (!send)
+    dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+  return send;
+}
+
+void H264Thinner::OnKeyframeSent() {
+  waiting_for_keyframe_ = false;
+}
+
+void H264Thinner::SetTargetBitrate(uint32_t bitrate) {
+  target_bitrate_ = bitrate;
+}
+
+void H264Thinner::ReceiveFractionLost(uint8_t fraction_lost,
+                                      int64_t now_millis) {
+  fraction_lost_ = fraction_lost;
+  if (fraction_lost > kHighFractionLost && level_ != Level::kKeyframesOnly &&
+      now_millis - last_change_millis_ >= kMinEscalateMillis)
+    SetLevel(static_cast<Level>(static_cast<int>(level_) + 1), now_millis);
+}
+
+H264Thinner::Stats H264Thinner::GetStats() const {
+  Stats stats;
+  stats.level =
+      static_cast<Level>(stats_level_.load(std::memory_order_relaxed));
+  stats.dropped_frames = dropped_frames_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void H264Thinner::UpdateLevel(int64_t now_millis) {
+  // Bitrates of the source, whatever is dropped.
+  double elapsed = now_millis - window_start_millis_;
+  auto smooth = [elapsed](double bitrate, uint64_t bytes) {
+    double window_bitrate = bytes * 8 * 1000 / elapsed;
+    return bitrate == 0 ? window_bitrate
+                        : kBitrateSmoothing * bitrate +
+                              (1 - kBitrateSmoothing) * window_bitrate;
+  };
+  key_bitrate_ = smooth(key_bitrate_, key_bytes_);
+  reference_bitrate_ = smooth(reference_bitrate_, reference_bytes_);
+  non_reference_bitrate_ = smooth(non_reference_bitrate_, non_reference_bytes_);
+  key_bytes_ = reference_bytes_ = non_reference_bytes_ = 0;
+  window_start_millis_ = now_millis;
+
+  // The lowest level whose frames fit into the estimate.
+  Level wanted = Level::kNone;
+  if (target_bitrate_ != 0) {
+    if (key_bitrate_ + reference_bitrate_ + non_reference_bitrate_ <=
+        target_bitrate_)
+      wanted = Level::kNone;
+    else if (key_bitrate_ + reference_bitrate_ <= target_bitrate_)
+      wanted = Level::kDropNonReference;
+    else
+      wanted = Level::kKeyframesOnly;
+  }
+
+  if (wanted > level_) {
+    SetLevel(wanted, now_millis);
+  } else if (wanted < level_ && fraction_lost_ < kLowFractionLost &&
+             now_millis - last_change_millis_ >= kRecoveryMillis) {
+    SetLevel(static_cast<Level>(static_cast<int>(level_) - 1), now_millis);
+  }
+}
+
+void H264Thinner::SetLevel(Level level, int64_t now_millis) {
+  spdlog::debug("H264 thinning level {} -> {}.", static_cast<int>(level_),
+                static_cast<int>(level));
+  level_ = level;
+  last_change_millis_ = now_millis;
+  stats_level_.store(static_cast<int>(level), std::memory_order_relaxed);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "media_packet.h"
+
+/**
+ * @brief Drops H264 frames of a congested viewer without transcoding.
+ *
+ * Non-reference frames (every slice has nal_ref_idc 0) go first, then all
+ * frames but IDR. Once a reference frame is dropped nothing is sent until
+ * the next IDR, so the decoder never sees a broken reference. Frames are
+ * dropped before packetization, so the RTP sequence numbers stay gapless.
+ *
+ * The level goes up as soon as the bandwidth estimate does not cover the
+ * frames sent or RTCP reports heavy loss, and down one step after a quiet
+ * period. Runs on the loop of the transport, except GetStats.
+ */
+class H264Thinner {
+ public:
+  enum class Level { kNone = 0, kDropNonReference = 1, kKeyframesOnly = 2 };
+
+  struct Stats {
+    Level level{Level::kNone};
+    uint64_t dropped_frames{0};
+  };
+
+  /**
+   * @brief Decide about one video frame.
+   *
+   * @return false if the frame must not be sent.
+   */
+  bool Filter(const MediaPacket& packet, int64_t now_millis);
+
+  // An IDR went out without Filter, as on a keyframe redelivery. The frames
+  // after it have a reference again.
+  void OnKeyframeSent();
+
+  // 0 until there is an estimate.
+  void SetTargetBitrate(uint32_t bitrate);
+
+  // |fraction_lost| of an RTCP report block, in 1/256.
+  void ReceiveFractionLost(uint8_t fraction_lost, int64_t now_millis);
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
+ private:
+  static constexpr int64_t kWindowMillis = 1000;
+  static constexpr double kBitrateSmoothing = 0.7;
+  // 10% and 2%.
+  static constexpr uint8_t kHighFractionLost = 26;
+  static constexpr uint8_t kLowFractionLost = 5;
+  static constexpr int64_t kMinEscalateMillis = 2000;
+  static constexpr int64_t kRecoveryMillis = 5000;
+
+  void UpdateLevel(int64_t now_millis);
+  void SetLevel(Level level, int64_t now_millis);
+
+  Level level_{Level::kNone};
+  bool waiting_for_keyframe_{false};
+  int64_t last_change_millis_{0};
+  uint32_t target_bitrate_{0};
+  uint8_t fraction_lost_{0};
+
+  int64_t window_start_millis_{-1};
+  uint64_t key_bytes_{0};
+  uint64_t reference_bytes_{0};
+  uint64_t non_reference_bytes_{0};
+  double key_bitrate_{0};
+  double reference_bitrate_{0};
+  double non_reference_bitrate_{0};
+
+  std::atomic<int> stats_level_{0};
+  std::atomic<uint64_t> dropped_frames_{0};
+};
@@ -4,7 +4,7 @@
 #include "stun_message.h"
 
 IceLite::IceLite(const std::string& remote_ufrag, Observer* observer)
-    : local_ufrag_{random_.RandomString(4)},
+    : local_ufrag_{random_.RandomString(8)},
       local_password_{random_.RandomString(24)},
       remote_ufrag_{remote_ufrag},
       observer_{observer} {}
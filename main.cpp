@@ -5,12 +5,15 @@
 
 #include "boost/asio.hpp"
 #include "dtls_context.h"
+#include "egress_scheduler.h"
+#include "event_loop_pool.h"
 #include "hmac_sha1.h"
 #include "media_source_manager.h"
 #include "server_config.h"
 #include "signaling_server.h"
 #include "spdlog/spdlog.h"
 #include "srtp_session.h"
+#include "udp_mux.h"
 #include "webrtc_transport_manager.h"
 
 int main(int argc, char* argv[]) {
@@ -28,6 +31,10 @@ int main(int argc, char* argv[]) {
   }
 
   WebrtcTransportManager::GetInstance().Start();
+  EventLoopPool::GetInstance().Start(
+      ServerConfig::GetInstance().GetWorkerThreads());
+  EgressScheduler::GetInstance().Start(
+      ServerConfig::GetInstance().GetEgressRateLimitKbps());
 
   if (!DtlsContext::GetInstance().Initialize()) {
     spdlog::error("Failed to initialize dtls.");
@@ -39,6 +46,18 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
+  if (ServerConfig::GetInstance().GetEnableUdpMux() &&
+      !UdpMux::GetInstance().Start(
+          ServerConfig::GetInstance().GetIp(),
+          ServerConfig::GetInstance().GetUdpMuxPort(),
+          ServerConfig::GetInstance().GetUdpMuxSocketCount())) {
+    spdlog::error("Failed to start udp mux.");
+    WebrtcTransportManager::GetInstance().Stop();
+    EventLoopPool::GetInstance().Stop();
+    EgressScheduler::GetInstance().Stop();
+    return EXIT_FAILURE;
+  }
+
   boost::asio::io_context ioc;
   std::shared_ptr<SignalingServer> server =
       std::make_shared<SignalingServer>(ioc);
@@ -46,6 +65,9 @@ int main(int argc, char* argv[]) {
                      ServerConfig::GetInstance().GetSignalingServerPort())) {
     spdlog::error("Signaling server failed to start.");
     WebrtcTransportManager::GetInstance().Stop();
+    UdpMux::GetInstance().Stop();
+    EventLoopPool::GetInstance().Stop();
+    EgressScheduler::GetInstance().Stop();
     return EXIT_FAILURE;
   }
 
@@ -56,6 +78,9 @@ int main(int argc, char* argv[]) {
           ioc.stop();
           MediaSourceManager::GetInstance().StopAll();
           WebrtcTransportManager::GetInstance().Stop();
+          UdpMux::GetInstance().Stop();
+          EventLoopPool::GetInstance().Stop();
+          EgressScheduler::GetInstance().Stop();
         }
       });
   ioc.run();
@@ -30,4 +30,21 @@ int64_t MediaPacket::TimestampMillis() const {
 
 bool MediaPacket::IsKey() const {
   return packet_.flags & AV_PKT_FLAG_KEY;
+}
+
+const std::shared_ptr<const RtpPacketGroup>& MediaPacket::RtpPackets() const {
+  return rtp_packets_;
+}
+
+void MediaPacket::RtpPackets(
+    std::shared_ptr<const RtpPacketGroup> rtp_packets) {
+  rtp_packets_ = std::move(rtp_packets);
+}
+
+const std::vector<H264Nalu>& MediaPacket::Nalus() const {
+  return nalus_;
+}
+
+void MediaPacket::Nalus(std::vector<H264Nalu> nalus) {
+  nalus_ = std::move(nalus);
 }
\ No newline at end of file
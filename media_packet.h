@@ -5,10 +5,14 @@
 #include <memory>
 #include <vector>
 
+#include "h264_parser.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 };
 
+class RtpPacketGroup;
+
 class MediaPacket {
  public:
   enum class Type : uint8_t { kVideo, kAudio };
@@ -26,8 +30,16 @@ class MediaPacket {
   void PacketType(enum Type type);
   int64_t TimestampMillis() const;
   bool IsKey() const;
+  // RTP packets shared by all viewers, null unless the source packetized it.
+  const std::shared_ptr<const RtpPacketGroup>& RtpPackets() const;
+  void RtpPackets(std::shared_ptr<const RtpPacketGroup> rtp_packets);
+  // NAL units of a video packet, empty unless the source parsed them.
+  const std::vector<H264Nalu>& Nalus() const;
+  void Nalus(std::vector<H264Nalu> nalus);
 
  private:
   Type type_;
   AVPacket packet_;
+  std::shared_ptr<const RtpPacketGroup> rtp_packets_;
+  std::vector<H264Nalu> nalus_;
 };
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "media_source.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 
 #include "byte_buffer.h"
 #include "utils.h"
@@ -86,6 +88,9 @@ bool MediaSource::Open(boost::string_view url) {
   if (av_bsf_init(bit_stream_filter_) < 0)
     return false;
 
+  if (ServerConfig::GetInstance().GetEnableSharedPacketization())
+    shared_packetizer_.reset(new SharedRtpPacketizer);
+
   url_ = url.data();
   guard.Dismiss();
   return true;
@@ -95,43 +100,102 @@ const std::string& MediaSource::Url() const {
   return url_;
 }
 
-void MediaSource::RegisterObserver(Observer* observer) {
+void MediaSource::RegisterObserver(std::weak_ptr<Observer> observer) {
+  auto key = observer.lock();
+  if (!key)
+    return;
   std::lock_guard<std::mutex> guard(observers_mutex_);
+  auto observers = std::atomic_load(&observers_);
+  for (auto& entry : *observers) {
+    if (entry.key == key.get())
+      return;
+  }
+
   if (!ServerConfig::GetInstance().GetEnableGopCache()) {
-    auto result = std::find(observers_.begin(), observers_.end(), observer);
-    if (result == observers_.end())
-      observers_.push_back(observer);
+    ObserverList new_list(*observers);
+    new_list.push_back({key.get(), observer});
+    PublishObservers(std::move(new_list));
   } else {
-    auto result = std::find(new_observers_.begin(), new_observers_.end(), observer);
-    if (result == new_observers_.end())
-      new_observers_.push_back(observer);
+    for (auto& entry : new_observers_) {
+      if (entry.key == key.get())
+        return;
+    }
+    new_observers_.push_back({key.get(), observer});
+    has_new_observers_ = true;
   }
 }
 
 void MediaSource::CheckNewObserver() {
-  std::lock_guard<std::mutex> guard(observers_mutex_);
-  auto cached_packets = gop_cache_.GetCachedPackets();
-
-  for (auto iter : new_observers_) {
-    for (auto packet : cached_packets) {
-      iter->OnMediaPacketGenerated(packet);
+  if (!has_new_observers_)
+    return;
+  // Dropping the last reference of an observer deregisters it, which takes
+  // |observers_mutex_| again. Keep them until the mutex is released.
+  std::vector<std::shared_ptr<Observer>> joined;
+  {
+    std::lock_guard<std::mutex> guard(observers_mutex_);
+    ObserverList new_list(*std::atomic_load(&observers_));
+    for (auto& entry : new_observers_) {
+      auto observer = entry.observer.lock();
+      if (!observer)
+        continue;
+      joined.push_back(std::move(observer));
+      new_list.push_back(entry);
     }
-    auto result = std::find(observers_.begin(), observers_.end(), iter);
-    if (result == observers_.end())
-      observers_.push_back(iter);
+    new_observers_.clear();
+    has_new_observers_ = false;
+    PublishObservers(std::move(new_list));
   }
-  new_observers_.clear();
+
+  // Live packets are delivered by this thread too, so the GOP still comes
+  // first. It is handed over whole, a long GOP would not fit in the queue
+  // of live packets.
+  auto cached_packets = gop_cache_.GetCachedPackets();
+  for (auto& observer : joined)
+    observer->OnCachedPacketsGenerated(cached_packets);
+}
+
+std::list<MediaPacket::Pointer> MediaSource::GetCachedPackets() {
+  return gop_cache_.GetCachedPackets();
+}
+
+MediaSource::Stats MediaSource::GetStats() const {
+  Stats stats;
+  stats.ingest_bytes = stats_ingest_bytes_.load(std::memory_order_relaxed);
+  stats.video_frames = stats_video_frames_.load(std::memory_order_relaxed);
+  stats.gop_frames = stats_gop_frames_.load(std::memory_order_relaxed);
+  stats.transcodes = stats_transcodes_.load(std::memory_order_relaxed);
+  stats.transcode_micros =
+      stats_transcode_micros_.load(std::memory_order_relaxed);
+  return stats;
 }
 
 void MediaSource::DeregisterObserver(Observer* observer) {
   std::lock_guard<std::mutex> guard(observers_mutex_);
-  auto result = std::find(observers_.begin(), observers_.end(), observer);
-  if (result != observers_.end())
-    observers_.erase(result);
-  if (ServerConfig::GetInstance().GetEnableGopCache()) {
-    auto result = std::find(new_observers_.begin(), new_observers_.end(), observer);
-    if (result != new_observers_.end())
-      new_observers_.erase(result);
+  auto is_observer = [observer](const ObserverEntry& entry) {
+    return entry.key == observer;
+  };
+  ObserverList new_list(*std::atomic_load(&observers_));
+  new_list.erase(std::remove_if(new_list.begin(), new_list.end(), is_observer),
+                 new_list.end());
+  PublishObservers(std::move(new_list));
+  new_observers_.erase(std::remove_if(new_observers_.begin(),
+                                      new_observers_.end(), is_observer),
+                       new_observers_.end());
+}
+
+void MediaSource::PublishObservers(ObserverList observers) {
+  std::atomic_store(&observers_,
+                    std::shared_ptr<const ObserverList>(
+                        std::make_shared<ObserverList>(std::move(observers))));
+}
+
+void MediaSource::DeliverPacket(const MediaPacket::Pointer& packet) {
+  // Observers that leave meanwhile are skipped by the weak pointer.
+  auto observers = std::atomic_load(&observers_);
+  for (auto& entry : *observers) {
+    auto observer = entry.observer.lock();
+    if (observer)
+      observer->OnMediaPacketGenerated(packet);
   }
 }
 
@@ -151,9 +215,12 @@ void MediaSource::Start() {
 }
 
 void MediaSource::StreamEnd() {
-  std::lock_guard<std::mutex> guard(observers_mutex_);
-  for (auto observer : observers_)
-    observer->OnMediaSouceEnd();
+  auto observers = std::atomic_load(&observers_);
+  for (auto& entry : *observers) {
+    auto observer = entry.observer.lock();
+    if (observer)
+      observer->OnMediaSouceEnd();
+  }
 }
 
 void MediaSource::ReadPacket() {
@@ -167,6 +234,7 @@ void MediaSource::ReadPacket() {
       StreamEnd();
       return;
     }
+    stats_ingest_bytes_.fetch_add(packet.size, std::memory_order_relaxed);
 
     if (packet.stream_index == video_index_) {
       if (bit_stream_filter_) {
@@ -183,9 +251,19 @@ void MediaSource::ReadPacket() {
 
       auto p = std::make_shared<MediaPacket>(&packet);
       p->PacketType(MediaPacket::Type::kVideo);
-      std::lock_guard<std::mutex> guard(observers_mutex_);
-      for (auto observer : observers_)
-        observer->OnMediaPacketGenerated(p);
+      p->Nalus(ParseH264Nalus(p->Data(), p->Size()));
+      stats_video_frames_.fetch_add(1, std::memory_order_relaxed);
+      if (p->IsKey()) {
+        if (keyframe_seen_)
+          stats_gop_frames_.store(frames_since_keyframe_,
+                                  std::memory_order_relaxed);
+        keyframe_seen_ = true;
+        frames_since_keyframe_ = 0;
+      }
+      ++frames_since_keyframe_;
+      if (shared_packetizer_)
+        shared_packetizer_->Pack(p);
+      DeliverPacket(p);
       if (ServerConfig::GetInstance().GetEnableGopCache())
         gop_cache_.AddPacket(p);
     } else if (packet.stream_index == audio_index_) {
@@ -204,14 +282,23 @@ void MediaSource::ReadPacket() {
           }
           auto p = std::make_shared<MediaPacket>(pkt);
           p->PacketType(MediaPacket::Type::kAudio);
-          std::lock_guard<std::mutex> guard(observers_mutex_);
-          for (auto observer : observers_)
-            observer->OnMediaPacketGenerated(p);
-            if (ServerConfig::GetInstance().GetEnableGopCache())
-              gop_cache_.AddPacket(p);
+          if (shared_packetizer_)
+            shared_packetizer_->Pack(p);
+          DeliverPacket(p);
+          if (ServerConfig::GetInstance().GetEnableGopCache())
+            gop_cache_.AddPacket(p);
         });
       }
+      // Delivery of the transcoded packets is included, it only queues them.
+      auto transcode_start = std::chrono::steady_clock::now();
       opus_transcoder_->Transcode(&packet);
+      auto transcode_micros =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - transcode_start)
+              .count();
+      stats_transcodes_.fetch_add(1, std::memory_order_relaxed);
+      stats_transcode_micros_.fetch_add(transcode_micros,
+                                        std::memory_order_relaxed);
     }
     av_packet_unref(&packet);
   }
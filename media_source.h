@@ -1,17 +1,18 @@
 #pragma once
 
 #include <atomic>
-#include <list>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 #include <cstdint>
 #include <boost/utility/string_view.hpp>
 
 #include "media_packet.h"
 #include "opus_transcoder.h"
 #include "gop_cache.h"
+#include "rtp_packet.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -24,33 +25,66 @@ class MediaSource {
   class Observer {
    public:
     virtual void OnMediaPacketGenerated(MediaPacket::Pointer packet) = 0;
+    // The GOP cache of a new observer, before any live packet.
+    virtual void OnCachedPacketsGenerated(
+        std::list<MediaPacket::Pointer> packets) = 0;
     virtual void OnMediaSouceEnd() = 0;
   };
 
+  struct Stats {
+    // Audio and video as read from the source.
+    uint64_t ingest_bytes{0};
+    uint64_t video_frames{0};
+    // From the last keyframe to the one before, 0 until the second one.
+    uint64_t gop_frames{0};
+    uint64_t transcodes{0};
+    uint64_t transcode_micros{0};
+  };
+
   bool Open(boost::string_view url);
   void Start();
   void Stop();
 
-  void RegisterObserver(Observer* observer);
+  void RegisterObserver(std::weak_ptr<Observer> observer);
   void DeregisterObserver(Observer* observer);
   const std::string& Url() const;
 
+  // Packets since the last keyframe, empty without GOP cache. Safe to call
+  // from any thread.
+  std::list<MediaPacket::Pointer> GetCachedPackets();
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
  private:
+  struct ObserverEntry {
+    Observer* key;
+    std::weak_ptr<Observer> observer;
+  };
+  using ObserverList = std::vector<ObserverEntry>;
+
   void ReadPacket();
   static int InterruptCB(void* opaque);
   bool IsIOTimeout();
   void UpdateIOTime();
   void StreamEnd();
   void CheckNewObserver();
+  void DeliverPacket(const MediaPacket::Pointer& packet);
+  // Publish a copy of the observer list, |observers_mutex_| must be held.
+  void PublishObservers(ObserverList observers);
   const static int64_t kDefaultIOTimeoutMillis = 10 * 1000; // 10s.
   AVFormatContext* stream_context_{nullptr};
   std::string url_;
   int video_index_{-1};
   int audio_index_{-1};
   int64_t last_io_time_{-1};
+  // Serializes the writers of |observers_| and guards |new_observers_|. The
+  // media source thread reads |observers_| without it.
   std::mutex observers_mutex_;
-  std::list<Observer*> observers_;
-  std::list<Observer*> new_observers_;
+  std::shared_ptr<const ObserverList> observers_{
+      std::make_shared<ObserverList>()};
+  ObserverList new_observers_;
+  std::atomic<bool> has_new_observers_{false};
   bool is_first_audio_packet_{true};
   int64_t first_audio_packet_timestamp_ms_{0};
   std::thread work_thread_;
@@ -58,4 +92,13 @@ class MediaSource {
   std::unique_ptr<OpusTranscoder> opus_transcoder_;
   AVBSFContext* bit_stream_filter_{nullptr};
   GopCache gop_cache_;
+  std::unique_ptr<SharedRtpPacketizer> shared_packetizer_;
+  // Only touched by the media source thread.
+  uint64_t frames_since_keyframe_{0};
+  bool keyframe_seen_{false};
+  std::atomic<uint64_t> stats_ingest_bytes_{0};
+  std::atomic<uint64_t> stats_video_frames_{0};
+  std::atomic<uint64_t> stats_gop_frames_{0};
+  std::atomic<uint64_t> stats_transcodes_{0};
+  std::atomic<uint64_t> stats_transcode_micros_{0};
 };
\ No newline at end of file
@@ -2,26 +2,16 @@
 
 #include <arpa/inet.h>
 
+#include <algorithm>
+#include <cmath>
+
 #include "byte_buffer.h"
+#include "h264_parser.h"
+#include "metrics.h"
 #include "server_config.h"
 #include "spdlog/spdlog.h"
 #include "utils.h"
 
-RtpStoragePacket::RtpStoragePacket(uint32_t ssrc,
-                                   uint16_t sequence_number,
-                                   uint32_t timestamp,
-                                   uint32_t header_offset,
-                                   uint8_t* data,
-                                   uint32_t size)
-    : ssrc_{ssrc},
-      sequence_number_{sequence_number},
-      timestamp_{timestamp},
-      header_offset_{header_offset},
-      size_{size} {
-  data_.reset(new uint8_t[size + kRtxExtraSize]);
-  memcpy(data_.get(), data, size);
-}
-
 uint32_t RtpStoragePacket::GetSsrc() const {
   return ssrc_;
 }
@@ -34,8 +24,8 @@ uint32_t RtpStoragePacket::GetTimestamp() const {
   return timestamp_;
 }
 
-uint8_t* RtpStoragePacket::Data() const {
-  return data_.get();
+uint8_t* RtpStoragePacket::Data() {
+  return data_;
 }
 
 uint32_t RtpStoragePacket::Size() const {
@@ -62,15 +52,14 @@ void RtpStoragePacket::MakeRtxPacket(uint32_t ssrc,
   // |                  Original RTP Packet Payload                  |
   // |                                                               |
   // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-  FixedRtpHeader* rtp_header = (FixedRtpHeader*)(data_.get());
+  FixedRtpHeader* rtp_header = (FixedRtpHeader*)data_;
   if (!is_rtx_) {
     // Calculate payload length.
     int payload_len = size_ - header_offset_;
     // Move the payload data back two bytes.
-    memmove(data_.get() + header_offset_ + 2, data_.get() + header_offset_,
-            payload_len);
+    memmove(data_ + header_offset_ + 2, data_ + header_offset_, payload_len);
     // Fill OSN.
-    memcpy(data_.get() + header_offset_, data_.get() + 2, 2);
+    memcpy(data_ + header_offset_, data_ + 2, 2);
     // Update ssrc, sequence number and payload type.
     rtp_header->SetSSrc(ssrc);
     rtp_header->SetSeqNum(sequence_number);
@@ -89,10 +78,189 @@ void RtpStoragePacket::SetResendMillisecs(uint64_t millisecs) {
   resent_millisecs_ = millisecs;
 }
 
+uint64_t RtpStoragePacket::GetSentMillisecs() const {
+  return sent_millisecs_;
+}
+
+ResendPriority RtpStoragePacket::GetPriority() const {
+  return priority_;
+}
+
+// RFC 8285 one-byte header extension block holding the transport-wide
+// sequence number, padded to a 32 bit boundary.
+static constexpr size_t kTransportSequenceExtensionSize = 8;
+
+// Adds the block with a zero sequence number unless it is already there.
+// FEC covers the header extension, so protected packets get it before FEC
+// is computed and only the number is written when they leave the pacer.
+static bool ReserveTransportSequenceNumber(PacketBuffer* buffer,
+                                           uint8_t extension_id) {
+  uint8_t* data = buffer->Data();
+  size_t size = buffer->Size();
+  if (size < kRtpHeaderFixedSize)
+    return false;
+  size_t header_size = kRtpHeaderFixedSize + (data[0] & 0x0f) * 4;
+  if (size < header_size)
+    return false;
+
+  uint8_t* extension = data + header_size;
+  if (data[0] & 0x10) {
+    return size >= header_size + kTransportSequenceExtensionSize &&
+           extension[0] == 0xBE && extension[1] == 0xDE &&
+           (extension[4] >> 4) == extension_id;
+  }
+  if (size + kTransportSequenceExtensionSize + PacketBuffer::kSrtpTrailerSize >
+      buffer->Capacity())
+    return false;
+  memmove(extension + kTransportSequenceExtensionSize, extension,
+          size - header_size);
+  extension[0] = 0xBE;
+  extension[1] = 0xDE;
+  extension[2] = 0;
+  extension[3] = 1;
+  extension[4] = (extension_id << 4) | 1;
+  extension[5] = 0;
+  extension[6] = 0;
+  extension[7] = 0;
+  data[0] |= 0x10;
+  buffer->SetSize(size + kTransportSequenceExtensionSize);
+  return true;
+}
+
+// The block must have been reserved.
+static void SetTransportSequenceNumber(PacketBuffer* buffer,
+                                       uint16_t sequence_number) {
+  uint8_t* data = buffer->Data();
+  uint8_t* extension = data + kRtpHeaderFixedSize + (data[0] & 0x0f) * 4;
+  StoreUInt16BE(extension + 5, sequence_number);
+}
+
+// https://tools.ietf.org/html/rfc2198#section-3
+// The primary block alone only needs a one byte RED header, F bit clear and
+// the payload type of the block.
+static bool EncapsulateInRed(PacketBuffer* buffer, uint8_t red_payload_type) {
+  uint8_t* data = buffer->Data();
+  size_t size = buffer->Size();
+  if (size < kRtpHeaderFixedSize)
+    return false;
+  size_t header_size = kRtpHeaderFixedSize + (data[0] & 0x0f) * 4;
+  if ((data[0] & 0x10) && size >= header_size + 4)
+    header_size += 4 + LoadUInt16BE(data + header_size + 2) * 4;
+  if (size < header_size ||
+      size + 1 + PacketBuffer::kSrtpTrailerSize > buffer->Capacity())
+    return false;
+
+  memmove(data + header_size + 1, data + header_size, size - header_size);
+  data[header_size] = data[1] & 0x7f;
+  data[1] = (data[1] & 0x80) | red_payload_type;
+  buffer->SetSize(size + 1);
+  return true;
+}
+
+static uint32_t RoundUpToPowerOfTwo(uint32_t value) {
+  uint32_t result = 1;
+  while (result < value && result < (1u << 16))
+    result <<= 1;
+  return result;
+}
+
+RtpPacketHistory::RtpPacketHistory(uint32_t capacity)
+    : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1) {
+  memory_usage_ = slots_.size() * sizeof(RtpStoragePacket);
+}
+
+void RtpPacketHistory::SetRetentionMillis(uint64_t millis) {
+  retention_millis_ = std::max(millis, kMinRetentionMillis);
+}
+
+void RtpPacketHistory::Put(const RtpPacket& pkt,
+                           ResendPriority priority,
+                           uint64_t now_millis) {
+  size_t index = pkt.GetSequenceNumber() & mask_;
+  RtpStoragePacket& slot = slots_[index];
+  slot = RtpStoragePacket();
+  if (pkt.Size() + RtpStoragePacket::kRtxExtraSize > kSlotSize) {
+    spdlog::warn("Rtp packet of {} bytes is too large to be stored.",
+                 pkt.Size());
+    return;
+  }
+  slot.stored_ = true;
+  slot.ssrc_ = pkt.GetSsrc();
+  slot.sequence_number_ = pkt.GetSequenceNumber();
+  slot.timestamp_ = pkt.GetTimestamp();
+  slot.header_offset_ = pkt.GetHeaderOffset();
+  slot.size_ = pkt.Size();
+  slot.priority_ = priority;
+  slot.sent_millisecs_ = now_millis;
+  slot.data_ = SlotData(index);
+  memcpy(slot.data_, pkt.Data(), pkt.Size());
+}
+
+void RtpPacketHistory::Put(uint32_t ssrc,
+                           uint16_t sequence_number,
+                           uint8_t payload_type,
+                           RtpPacketGroup::Pointer group,
+                           size_t index,
+                           ResendPriority priority,
+                           uint64_t now_millis) {
+  RtpStoragePacket& slot = slots_[sequence_number & mask_];
+  slot = RtpStoragePacket();
+  slot.stored_ = true;
+  slot.ssrc_ = ssrc;
+  slot.sequence_number_ = sequence_number;
+  slot.payload_type_ = payload_type;
+  slot.timestamp_ = group->GetTimestamp();
+  slot.header_offset_ = kRtpHeaderFixedSize;
+  slot.size_ = group->Size(index);
+  slot.priority_ = priority;
+  slot.sent_millisecs_ = now_millis;
+  slot.group_ = std::move(group);
+  slot.index_ = index;
+}
+
+RtpStoragePacket* RtpPacketHistory::Get(uint16_t sequence_number,
+                                        uint64_t now_millis) {
+  size_t index = sequence_number & mask_;
+  RtpStoragePacket& slot = slots_[index];
+  if (!slot.stored_ || slot.sequence_number_ != sequence_number ||
+      now_millis - slot.sent_millisecs_ > retention_millis_)
+    return nullptr;
+
+  if (slot.group_) {
+    if (slot.size_ + RtpStoragePacket::kRtxExtraSize > kSlotSize)
+      return nullptr;
+    slot.data_ = SlotData(index);
+    memcpy(slot.data_, slot.group_->Data(slot.index_), slot.size_);
+    FixedRtpHeader* rtp_header = (FixedRtpHeader*)slot.data_;
+    rtp_header->SetSSrc(slot.ssrc_);
+    rtp_header->SetSeqNum(slot.sequence_number_);
+    rtp_header->SetPayloadType(slot.payload_type_);
+    slot.group_.reset();
+  }
+  return &slot;
+}
+
+size_t RtpPacketHistory::MemoryUsage() const {
+  return memory_usage_.load(std::memory_order_relaxed);
+}
+
+uint8_t* RtpPacketHistory::SlotData(size_t index) {
+  if (!slab_) {
+    slab_.reset(new uint8_t[slots_.size() * kSlotSize]);
+    memory_usage_ += slots_.size() * kSlotSize;
+  }
+  return slab_.get() + index * kSlotSize;
+}
+
 StreamTrack::StreamTrack(const RtpParams& params, Observer* observer)
     : params_{params},
       observer_{observer},
-      max_resend_delay_in_clock_rate_{params.clock_rate * 2} {}
+      packet_history_{
+          params.media_type == RtpParams::MediaType::kVideo
+              ? ServerConfig::GetInstance().GetVideoNackHistorySize()
+              : ServerConfig::GetInstance().GetAudioNackHistorySize()},
+      resend_budget_ratio_{
+          ServerConfig::GetInstance().GetResendBudgetRatio()} {}
 
 std::unique_ptr<SenderReportPacket> StreamTrack::CreateRtcpSenderReport(
     uint64_t now_millis) {
@@ -119,141 +287,538 @@ void StreamTrack::ReceiveReceiverReport(const ReportBlock& report_block) {
     uint32_t rtp_compact_ntp =
         compact_ntp - report_block.delay_since_last_sr - report_block.last_sr;
     rtt_ = NtpTime::CreateFromCompactNtp(rtp_compact_ntp).ToMillis();
+    packet_history_.SetRetentionMillis(2 * rtt_);
+    stats_rtt_millis_.store(rtt_, std::memory_order_relaxed);
+  }
+
+  // The cumulative number of packets lost is a signed 24 bit value.
+  int32_t cumulative_lost = report_block.cumulative_lost & 0xffffff;
+  if (cumulative_lost & 0x800000)
+    cumulative_lost -= 0x1000000;
+  stats_fraction_lost_.store(report_block.fraction_lost,
+                             std::memory_order_relaxed);
+  stats_cumulative_lost_.store(cumulative_lost, std::memory_order_relaxed);
+  if (params_.clock_rate != 0) {
+    stats_jitter_millis_.store(
+        static_cast<uint64_t>(report_block.jitter) * 1000 / params_.clock_rate,
+        std::memory_order_relaxed);
   }
 }
 
-void StreamTrack::ReceiveNack(NackPacket* nack_packet) {
-  if (!nack_packet || nack_packet->GetMediaSsrc() != params_.ssrc ||
-      !params_.is_nack_enable_)
+void StreamTrack::ReceiveNack(const RtcpNackView& nack) {
+  if (nack.GetMediaSsrc() != params_.ssrc || !params_.is_nack_enable_)
     return;
-  auto lost_packets = nack_packet->GetLostPacketSequenceNumbers();
 
-  for (auto seq_num : lost_packets) {
-    RtpStoragePacket* pkt = send_buffer_[seq_num % kSendBufferCapacity].get();
+  uint64_t now = TimeMillis();
+  uint64_t nacked_packets = 0;
+  resend_packets_.clear();
+  nack.ForEachLostPacket([&](uint16_t seq_num) {
+    ++nacked_packets;
+    RtpStoragePacket* pkt = packet_history_.Get(seq_num, now);
     if (!pkt)
-      continue;
-
-    if ((max_rtp_timestamp_ - pkt->GetTimestamp()) >
-        max_resend_delay_in_clock_rate_) {
-      continue;
-    }
+      return;
 
-    uint64_t now = TimeMillis();
     if (pkt->GetResendMillisecs() != 0 &&
         now - pkt->GetResendMillisecs() <= static_cast<uint64_t>(rtt_)) {
-      continue;
+      return;
     }
-    pkt->SetResendMillisecs(now);
+    if (pkt->GetPriority() != ResendPriority::kKeyframe &&
+        now + rtt_ / 2 > pkt->GetSentMillisecs() + kPlayoutDeadlineMillis)
+      return;
+    resend_packets_.push_back(pkt);
+  });
+  stats_nack_packets_.fetch_add(1, std::memory_order_relaxed);
+  stats_nacked_packets_.fetch_add(nacked_packets, std::memory_order_relaxed);
+
+  // One pass per priority keeps the NACK order within a priority.
+  for (auto priority :
+       {ResendPriority::kKeyframe, ResendPriority::kReference,
+        ResendPriority::kOther}) {
+    for (auto pkt : resend_packets_) {
+      if (pkt->GetPriority() != priority)
+        continue;
+      if (resend_budget_ratio_ > 0) {
+        if (resend_budget_bytes_ < static_cast<int64_t>(pkt->Size()))
+          continue;
+        resend_budget_bytes_ -= pkt->Size();
+      }
+      pkt->SetResendMillisecs(now);
 
-    if (params_.is_rtx_enabled) {
-      pkt->MakeRtxPacket(params_.rtx_ssrc, rtx_sequence_number_++,
-                         params_.rtx_payload_type);
+      if (params_.is_rtx_enabled) {
+        pkt->MakeRtxPacket(params_.rtx_ssrc, rtx_sequence_number_++,
+                           params_.rtx_payload_type);
+      }
+      stats_resent_packets_.fetch_add(1, std::memory_order_relaxed);
+      stats_resent_bytes_.fetch_add(pkt->Size(), std::memory_order_relaxed);
+      Metrics::GetInstance().retransmitted_packets.Add(1);
+      Metrics::GetInstance().retransmitted_bytes.Add(pkt->Size());
+      if (observer_)
+        observer_->OnStreamTrackResendPacket(
+            pkt, params_.media_type == RtpParams::MediaType::kAudio);
     }
-    if (observer_)
-      observer_->OnStreamTrackResendPacket(pkt);
   }
 }
 
 void StreamTrack::ReceivePacket(RtpPacket* pkt) {
   if (!pkt || pkt->GetSsrc() != params_.ssrc)
     return;
+  // The track owns the sequence space, FEC packets take numbers from it too.
+  pkt->SetSequenceNumber(sequence_number_++);
   send_packet_count_++;
   send_octets_ += pkt->Size();
+  AddResendBudget(pkt->Size());
   max_rtp_timestamp_ = pkt->GetTimestamp();
   max_packet_millis_ = TimeMillis();
 
   if (params_.is_nack_enable_) {
-    send_buffer_[pkt->GetSequenceNumber() % kSendBufferCapacity] =
-        std::move(std::make_unique<RtpStoragePacket>(
-            pkt->GetSsrc(), pkt->GetSequenceNumber(), pkt->GetTimestamp(),
-            pkt->GetHeaderOffset(), pkt->Data(), pkt->Size()));
+    packet_history_.Put(
+        *pkt,
+        GetResendPriority(pkt->Data() + pkt->GetHeaderOffset(),
+                          pkt->Size() - pkt->GetHeaderOffset()),
+        TimeMillis());
   }
 }
 
+void StreamTrack::ReceiveSharedPacket(const RtpPacketGroup::Pointer& group,
+                                      size_t index,
+                                      uint8_t* header) {
+  uint16_t sequence_number = sequence_number_++;
+  memcpy(header, group->Data(index), kRtpHeaderFixedSize);
+  FixedRtpHeader* rtp_header = (FixedRtpHeader*)header;
+  rtp_header->SetSSrc(params_.ssrc);
+  rtp_header->SetSeqNum(sequence_number);
+  rtp_header->SetPayloadType(params_.payload_type);
+
+  send_packet_count_++;
+  send_octets_ += group->Size(index);
+  AddResendBudget(group->Size(index));
+  max_rtp_timestamp_ = group->GetTimestamp();
+  max_packet_millis_ = TimeMillis();
+
+  if (params_.is_nack_enable_) {
+    packet_history_.Put(
+        params_.ssrc, sequence_number, params_.payload_type, group, index,
+        GetResendPriority(group->Data(index) + kRtpHeaderFixedSize,
+                          group->Size(index) - kRtpHeaderFixedSize),
+        TimeMillis());
+  }
+}
+
+uint16_t StreamTrack::ReceiveFecPacket(uint32_t size) {
+  send_packet_count_++;
+  send_octets_ += size;
+  return sequence_number_++;
+}
+
+size_t StreamTrack::GetRetransmissionMemory() const {
+  return packet_history_.MemoryUsage();
+}
+
+uint64_t StreamTrack::GetRttMillis() const {
+  return rtt_;
+}
+
+StreamTrack::Stats StreamTrack::GetStats() const {
+  Stats stats;
+  stats.rtt_millis = stats_rtt_millis_.load(std::memory_order_relaxed);
+  stats.fraction_lost = stats_fraction_lost_.load(std::memory_order_relaxed);
+  stats.cumulative_lost =
+      stats_cumulative_lost_.load(std::memory_order_relaxed);
+  stats.jitter_millis = stats_jitter_millis_.load(std::memory_order_relaxed);
+  stats.nack_packets = stats_nack_packets_.load(std::memory_order_relaxed);
+  stats.nacked_packets = stats_nacked_packets_.load(std::memory_order_relaxed);
+  stats.resent_packets = stats_resent_packets_.load(std::memory_order_relaxed);
+  stats.resent_bytes = stats_resent_bytes_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void StreamTrack::AddResendBudget(uint32_t size) {
+  resend_budget_bytes_ += static_cast<int64_t>(size * resend_budget_ratio_);
+  if (resend_budget_bytes_ > kMaxResendBudgetBytes)
+    resend_budget_bytes_ = kMaxResendBudgetBytes;
+}
+
+ResendPriority StreamTrack::GetResendPriority(const uint8_t* payload,
+                                              size_t size) const {
+  if (params_.media_type != RtpParams::MediaType::kVideo || size < 2)
+    return ResendPriority::kOther;
+  uint8_t nal_ref_idc = payload[0] & 0x60;
+  uint8_t nal_type = payload[0] & 0x1f;
+  // The first NALU of a STAP-A, the fragmented one of a FU-A.
+  if (nal_type == 24 && size >= 4)
+    nal_type = payload[3] & 0x1f;
+  else if (nal_type == 28)
+    nal_type = payload[1] & 0x1f;
+  if (nal_type == kH264NaluIdr || nal_type == kH264NaluSps ||
+      nal_type == kH264NaluPps)
+    return ResendPriority::kKeyframe;
+  return nal_ref_idc != 0 ? ResendPriority::kReference : ResendPriority::kOther;
+}
+
 MediaStream::MediaStream(boost::asio::io_context& io_context, Observer* observer)
     : io_context_{io_context}, observer_{observer} {
   rtcp_timer_ = std::make_unique<Timer>(io_context_, this);
-  rtcp_timer_->AsyncWait(200);
+  // Early enough for lip sync, later reports follow RFC 3550.
+  rtcp_timer_->AsyncWait(kInitialRtcpDelayMillis);
+  last_rtcp_millis_ = TimeMillis();
+  double pacing_factor = ServerConfig::GetInstance().GetPacingFactor();
+  if (pacing_factor > 0)
+    pacer_ = std::make_unique<Pacer>(io_context_, pacing_factor, this);
+  if (ServerConfig::GetInstance().GetEnableTemporalThinning())
+    h264_thinner_ = std::make_unique<H264Thinner>();
 }
 
 void MediaStream::AddStreamTrack(const StreamTrack::RtpParams& params) {
   if (params.media_type == StreamTrack::RtpParams::MediaType::kVideo) {
     h264_packetizer_ = std::make_unique<H264RtpPacketizer>(
         params.ssrc, params.payload_type, params.clock_rate, this);
+    video_ssrc_ = params.ssrc;
+    if (params.is_ulpfec_enabled) {
+      ulpfec_generator_ = std::make_unique<UlpfecGenerator>();
+      red_payload_type_ = params.red_payload_type;
+      ulpfec_payload_type_ = params.ulpfec_payload_type;
+    }
   } else if (params.media_type == StreamTrack::RtpParams::MediaType::kAudio) {
     opus_packetizer_ = std::make_unique<OpusRtpPacketizer>(
         params.ssrc, params.payload_type, params.clock_rate, this);
+    audio_ssrc_ = params.ssrc;
+    if (params.is_red_enabled) {
+      audio_red_encoder_ =
+          std::make_unique<AudioRedEncoder>(params.red_payload_type);
+    }
+  }
+  if (params.is_twcc_enable_ && !bandwidth_estimator_) {
+    twcc_extension_id_ = params.twcc_extension_id_;
+    bandwidth_estimator_ = std::make_unique<BandwidthEstimator>();
+    observer_->OnTargetBitrateUpdate(bandwidth_estimator_->GetTargetBitrate());
   }
+  if (cname_.empty())
+    cname_ = params.cname;
   stream_tracks_[params.ssrc] = std::make_unique<StreamTrack>(params, this);
 }
 
 void MediaStream::ReceiveH264Packet(MediaPacket::Pointer packet) {
-  h264_packetizer_->Pack(packet);
+  last_video_packet_ = packet;
+  if (h264_thinner_ && !h264_thinner_->Filter(*packet, TimeMillis()))
+    return;
+  if (packet->RtpPackets())
+    SendRtpPacketGroup(video_ssrc_, packet->RtpPackets());
+  else
+    h264_packetizer_->Pack(packet);
 }
 
 void MediaStream::ReceiveOpusPacket(MediaPacket::Pointer packet) {
-  opus_packetizer_->Pack(packet);
+  if (packet->RtpPackets())
+    SendRtpPacketGroup(audio_ssrc_, packet->RtpPackets());
+  else
+    opus_packetizer_->Pack(packet);
+}
+
+size_t MediaStream::GetRetransmissionMemory() const {
+  size_t bytes = 0;
+  for (auto& stream_track : stream_tracks_)
+    bytes += stream_track.second->GetRetransmissionMemory();
+  return bytes;
+}
+
+Pacer::Stats MediaStream::GetPacerStats() const {
+  return pacer_ ? pacer_->GetStats() : Pacer::Stats();
+}
+
+H264Thinner::Stats MediaStream::GetThinningStats() const {
+  return h264_thinner_ ? h264_thinner_->GetStats() : H264Thinner::Stats();
+}
+
+StreamTrack::Stats MediaStream::GetVideoStats() const {
+  auto stream_iter = stream_tracks_.find(video_ssrc_);
+  return stream_iter != stream_tracks_.end() ? stream_iter->second->GetStats()
+                                             : StreamTrack::Stats();
+}
+
+StreamTrack::Stats MediaStream::GetAudioStats() const {
+  auto stream_iter = stream_tracks_.find(audio_ssrc_);
+  return stream_iter != stream_tracks_.end() ? stream_iter->second->GetStats()
+                                             : StreamTrack::Stats();
+}
+
+uint32_t MediaStream::GetEgressBitrate() const {
+  return stats_egress_bitrate_.load(std::memory_order_relaxed);
 }
 
 void MediaStream::ReceiveRctp(uint8_t* data, int len) {
-  RtcpCompound rtcp_compound;
-  if (!rtcp_compound.Parse(data, len)) {
+  if (len <= 0 || !RtcpParser::Parse(data, len, this))
     spdlog::warn("Failed to parse compound rtcp.");
+}
+
+void MediaStream::OnReportBlock(const ReportBlock& report_block) {
+  // When RTX is enabled, the RR packet of RTX is ignored.
+  auto stream_iter = stream_tracks_.find(report_block.source_ssrc);
+  if (stream_iter != stream_tracks_.end())
+    stream_iter->second->ReceiveReceiverReport(report_block);
+  if (audio_red_encoder_ && report_block.source_ssrc == audio_ssrc_)
+    audio_red_encoder_->SetFractionLost(report_block.fraction_lost);
+  if (report_block.source_ssrc != video_ssrc_)
     return;
+  if (h264_thinner_)
+    h264_thinner_->ReceiveFractionLost(report_block.fraction_lost,
+                                       TimeMillis());
+  if (ulpfec_generator_)
+    ulpfec_generator_->SetFractionLost(report_block.fraction_lost);
+}
+
+void MediaStream::OnNack(const RtcpNackView& nack) {
+  auto stream_iter = stream_tracks_.find(nack.GetMediaSsrc());
+  if (stream_iter != stream_tracks_.end())
+    stream_iter->second->ReceiveNack(nack);
+}
+
+void MediaStream::OnPli(uint32_t media_ssrc) {
+  if (media_ssrc == video_ssrc_)
+    ReceiveKeyframeRequest();
+}
+
+void MediaStream::OnFir(uint32_t media_ssrc) {
+  if (media_ssrc == video_ssrc_)
+    ReceiveKeyframeRequest();
+}
+
+void MediaStream::OnRemb(uint64_t bitrate) {
+  // TWCC is the better estimate when both are sent.
+  if (bandwidth_estimator_)
+    return;
+  if (bitrate > UINT32_MAX)
+    bitrate = UINT32_MAX;
+  UpdateTargetBitrate(static_cast<uint32_t>(bitrate));
+}
+
+void MediaStream::OnTransportFeedback(
+    const RtcpTransportFeedbackView& feedback) {
+  if (!bandwidth_estimator_ || !feedback.GetPacketResults(&packet_results_))
+    return;
+  bandwidth_estimator_->OnTransportFeedback(packet_results_, TimeMillis());
+  UpdateTargetBitrate(bandwidth_estimator_->GetTargetBitrate());
+}
+
+void MediaStream::UpdateTargetBitrate(uint32_t target_bitrate) {
+  if (pacer_)
+    pacer_->SetTargetBitrate(target_bitrate);
+  if (h264_thinner_)
+    h264_thinner_->SetTargetBitrate(target_bitrate);
+  observer_->OnTargetBitrateUpdate(target_bitrate);
+}
+
+void MediaStream::ReceiveKeyframeRequest() {
+  auto stream_iter = stream_tracks_.find(video_ssrc_);
+  if (stream_iter == stream_tracks_.end())
+    return;
+  int64_t now_millis = TimeMillis();
+  int64_t interval_millis =
+      std::max<int64_t>(kMinRedeliveryIntervalMillis,
+                        2 * stream_iter->second->GetRttMillis());
+  if (last_redelivery_millis_ >= 0 &&
+      now_millis - last_redelivery_millis_ < interval_millis)
+    return;
+  last_redelivery_millis_ = now_millis;
+  observer_->OnKeyframeRequest();
+}
+
+void MediaStream::RedeliverKeyframe(
+    const std::list<MediaPacket::Pointer>& packets) {
+  if (!h264_packetizer_)
+    return;
+  auto key_iter = std::find_if(
+      packets.begin(), packets.end(), [](const MediaPacket::Pointer& packet) {
+        return packet->PacketType() == MediaPacket::Type::kVideo &&
+               packet->IsKey();
+      });
+  if (key_iter == packets.end())
+    return;
+  auto end_iter = std::find(key_iter, packets.end(), last_video_packet_);
+  if (end_iter == packets.end())
+    return;
+  ++end_iter;
+
+  size_t gop_bytes = 0;
+  for (auto iter = key_iter; iter != end_iter; ++iter) {
+    if ((*iter)->PacketType() == MediaPacket::Type::kVideo)
+      gop_bytes += (*iter)->Size();
   }
-  auto rtcp_packets = rtcp_compound.GetRtcpPackets();
-  for (auto p : rtcp_packets) {
-    if (p->Type() == kRtcpTypeRtpfb) {
-      if (p->Format() == 1) {
-        NackPacket* nack_packet = dynamic_cast<NackPacket*>(p);
-        stream_tracks_[nack_packet->GetMediaSsrc()]->ReceiveNack(nack_packet);
-      } else if (p->Format() == 15) {
-        // spdlog::debug("twcc .....");
-      } else {
-        spdlog::debug("fb format = {}", p->Format());
-      }
-    } else if (p->Type() == kRtcpTypeRr) {
-      ReceiverReportPacket* rr_packet = dynamic_cast<ReceiverReportPacket*>(p);
-      auto report_blocks = rr_packet->GetReportBlocks();
-      for (auto block : report_blocks) {
-        // When RTX is enabled, the RR packet of RTX is ignored.
-        auto stream_iter = stream_tracks_.find(block.source_ssrc);
-        if (stream_iter != stream_tracks_.end())
-          stream_iter->second->ReceiveReceiverReport(block);
-      }
-    }
+  bool whole_gop = gop_bytes <= kMaxRedeliveryBytes;
+  spdlog::debug("Redeliver {} of a {} bytes GOP.",
+                whole_gop ? "all" : "the keyframe", gop_bytes);
+
+  // One tick apart, the decoder catches up and the next live frame is still
+  // later than all of them.
+  redelivering_ = true;
+  for (auto iter = key_iter; iter != end_iter; ++iter) {
+    if ((*iter)->PacketType() != MediaPacket::Type::kVideo)
+      continue;
+    if (iter != key_iter && !whole_gop)
+      break;
+    redelivery_timestamp_ = ++last_video_timestamp_;
+    h264_packetizer_->Pack(*iter);
   }
+  redelivering_ = false;
+  // Not counted by the thinner, but it must not keep waiting for an IDR.
+  if (h264_thinner_)
+    h264_thinner_->OnKeyframeSent();
 }
 
 void MediaStream::RtpPacketSent(RtpPacket* pkt) {
   stream_tracks_[pkt->GetSsrc()]->ReceivePacket(pkt);
 }
 
-void MediaStream::OnStreamTrackResendPacket(RtpStoragePacket* pkt) {
-  observer_->OnRtpPacketSend(pkt->Data(), pkt->Size());
+void MediaStream::SendRtpPacketGroup(uint32_t ssrc,
+                                     const RtpPacketGroup::Pointer& group) {
+  auto& stream_track = stream_tracks_[ssrc];
+  if (ssrc == video_ssrc_)
+    last_video_timestamp_ = group->GetTimestamp();
+  for (size_t i = 0; i < group->Count(); ++i) {
+    auto buffer = PacketBufferPool::GetInstance().Acquire(group->Size(i));
+    stream_track->ReceiveSharedPacket(group, i, buffer->Data());
+    memcpy(buffer->Data() + kRtpHeaderFixedSize,
+           group->Data(i) + kRtpHeaderFixedSize,
+           group->Size(i) - kRtpHeaderFixedSize);
+    buffer->SetSize(group->Size(i));
+    SendRtpPacket(ssrc, std::move(buffer));
+  }
+}
+
+void MediaStream::SendRtpPacket(uint32_t ssrc, PacketBuffer::Pointer buffer) {
+  if (ssrc == video_ssrc_ && ulpfec_generator_) {
+    SendProtectedVideoPacket(std::move(buffer));
+    return;
+  }
+  if (ssrc == audio_ssrc_ && audio_red_encoder_)
+    audio_red_encoder_->Encode(buffer.get());
+  PaceRtpPacket(std::move(buffer), ssrc == audio_ssrc_);
+}
+
+void MediaStream::PaceRtpPacket(PacketBuffer::Pointer buffer, bool is_audio) {
+  if (pacer_)
+    pacer_->Enqueue(std::move(buffer), is_audio);
+  else
+    OnPacerPacketSend(std::move(buffer), is_audio);
+}
+
+void MediaStream::SendProtectedVideoPacket(PacketBuffer::Pointer buffer) {
+  // The receiver recovers the packet as it is without RED.
+  if (bandwidth_estimator_)
+    ReserveTransportSequenceNumber(buffer.get(), twcc_extension_id_);
+  size_t fec_count =
+      ulpfec_generator_->AddMediaPacket(buffer->Data(), buffer->Size());
+  uint32_t timestamp = LoadUInt32BE(buffer->Data() + 4);
+  EncapsulateInRed(buffer.get(), red_payload_type_);
+  PaceRtpPacket(std::move(buffer), false);
+
+  auto& stream_track = stream_tracks_[video_ssrc_];
+  for (size_t i = 0; i < fec_count; ++i) {
+    auto fec_buffer = PacketBufferPool::GetInstance().Acquire();
+    uint8_t* data = fec_buffer->Data();
+    size_t size = kRtpHeaderFixedSize + 1 +
+                  ulpfec_generator_->WriteFecPacket(
+                      i, data + kRtpHeaderFixedSize + 1);
+    FixedRtpHeader* rtp_header = (FixedRtpHeader*)data;
+    rtp_header->SetVersion(2);
+    rtp_header->SetPadding(0);
+    rtp_header->SetHasExtension(0);
+    rtp_header->SetCC(0);
+    rtp_header->SetMarker(0);
+    rtp_header->SetPayloadType(red_payload_type_);
+    rtp_header->SetSeqNum(stream_track->ReceiveFecPacket(size));
+    rtp_header->SetTimestamp(timestamp);
+    rtp_header->SetSSrc(video_ssrc_);
+    data[kRtpHeaderFixedSize] = ulpfec_payload_type_;
+    fec_buffer->SetSize(size);
+    PaceRtpPacket(std::move(fec_buffer), false);
+  }
+}
+
+void MediaStream::OnPacerPacketSend(PacketBuffer::Pointer buffer,
+                                    bool is_audio) {
+  sent_bytes_ += buffer->Size();
+  if (bandwidth_estimator_ &&
+      ReserveTransportSequenceNumber(buffer.get(), twcc_extension_id_)) {
+    SetTransportSequenceNumber(buffer.get(), transport_sequence_number_);
+    bandwidth_estimator_->OnPacketSent(transport_sequence_number_++,
+                                       buffer->Size(), TimeMillis());
+  }
+  observer_->OnRtpPacketSend(std::move(buffer), is_audio);
+}
+
+void MediaStream::OnStreamTrackResendPacket(RtpStoragePacket* pkt,
+                                            bool is_audio) {
+  auto buffer = PacketBufferPool::GetInstance().Acquire(pkt->Size());
+  memcpy(buffer->Data(), pkt->Data(), pkt->Size());
+  buffer->SetSize(pkt->Size());
+  PaceRtpPacket(std::move(buffer), is_audio);
 }
 
 void MediaStream::OnRtpPacketGenerated(RtpPacket* pkt) {
-  observer_->OnRtpPacketSend(pkt->Data(), pkt->Size());
+  if (pkt->GetSsrc() == video_ssrc_) {
+    if (redelivering_)
+      pkt->SetTimestamp(redelivery_timestamp_);
+    last_video_timestamp_ = pkt->GetTimestamp();
+  }
+  // Store it before it is extended and encrypted in place.
   RtpPacketSent(pkt);
+  SendRtpPacket(pkt->GetSsrc(), pkt->ReleaseBuffer());
 }
 
 void MediaStream::OnTimerTimeout() {
   auto now_millis = TimeMillis();
+  uint8_t buffer[1500];
+  ByteWriter byte_write(buffer, 1500);
+  SdesPacket sdes_packet;
   for (auto iter = stream_tracks_.begin(); iter != stream_tracks_.end(); ++iter) {
     auto sr_packet = iter->second->CreateRtcpSenderReport(now_millis);
-    if (!sr_packet)
+    if (!sr_packet || !sr_packet->Serialize(&byte_write))
       continue;
-    uint8_t buffer[1500];
-    ByteWriter byte_write(buffer, 1500);
-    if (sr_packet->Serialize(&byte_write)) {
-      observer_->OnRtcpPacketSend(byte_write.Data(), byte_write.Used());
-    }
+    sdes_packet.AddCname(iter->first, cname_);
   }
+  if (byte_write.Used() > 0 && sdes_packet.Serialize(&byte_write)) {
+    observer_->OnRtcpPacketSend(byte_write.Data(), byte_write.Used());
+    size_t size = byte_write.Used() + kRtcpOverheadBytes;
+    average_rtcp_size_ = rtcp_sent_ ? average_rtcp_size_ +
+                                          (size - average_rtcp_size_) / 16
+                                    : size;
+    rtcp_sent_ = true;
+  }
+
+  rtcp_timer_->AsyncWait(NextRtcpIntervalMillis(now_millis));
+}
 
-  rtcp_timer_->AsyncWait(200);
+uint64_t MediaStream::NextRtcpIntervalMillis(int64_t now_millis) {
+  double session_bitrate = kMinSessionBitrate;
+  if (now_millis > last_rtcp_millis_) {
+    double sent_bitrate =
+        sent_bytes_ * 8000.0 / (now_millis - last_rtcp_millis_);
+    stats_egress_bitrate_.store(static_cast<uint32_t>(sent_bitrate),
+                                std::memory_order_relaxed);
+    session_bitrate = std::max(session_bitrate, sent_bitrate);
+  }
+  sent_bytes_ = 0;
+  last_rtcp_millis_ = now_millis;
+
+  // One sender and one receiver, the senders are more than a quarter of the
+  // members, so all members share the RTCP bandwidth.
+  const double members = 2;
+  double rtcp_bytes_per_second = session_bitrate * kRtcpBandwidthFraction / 8;
+  double interval_millis =
+      average_rtcp_size_ * members / rtcp_bytes_per_second * 1000;
+  double min_interval_millis = 360.0 / (session_bitrate / 1000) * 1000;
+  if (!rtcp_sent_)
+    min_interval_millis /= 2;
+  interval_millis = std::max(interval_millis, min_interval_millis);
+  if (interval_millis > kMaxRtcpIntervalMillis)
+    interval_millis = kMaxRtcpIntervalMillis;
+  // Randomized over [0.5, 1.5] and compensated for timer reconsideration.
+  interval_millis *= random_.RandomUInt(500, 1500) / 1000.0;
+  interval_millis /= M_E - 1.5;
+  return static_cast<uint64_t>(interval_millis);
 }
 
 void MediaStream::Stop() {
   rtcp_timer_.reset();
+  pacer_.reset();
 }
\ No newline at end of file
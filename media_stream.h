@@ -1,32 +1,44 @@
 #pragma once
 
-#include <array>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <cstdint>
+#include <list>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "audio_red_encoder.h"
+#include "bandwidth_estimator.h"
+#include "h264_thinner.h"
 #include "media_packet.h"
+#include "pacer.h"
+#include "random.h"
 #include "rtcp_packet.h"
+#include "rtcp_parser.h"
 #include "rtp_packet.h"
 #include "timer.h"
+#include "ulpfec_generator.h"
+
+// Order in which NACKed packets are resent when the budget is short.
+enum class ResendPriority : uint8_t {
+  // IDR slices and parameter sets.
+  kKeyframe = 0,
+  // Slices other frames refer to.
+  kReference = 1,
+  kOther = 2
+};
 
 class RtpStoragePacket {
  public:
-  RtpStoragePacket(uint32_t ssrc,
-                   uint16_t sequence_number,
-                   uint32_t timestamp,
-                   uint32_t header_offset,
-                   uint8_t* data,
-                   uint32_t size);
   uint32_t GetSsrc() const;
 
   uint16_t GetSequenceNumber() const;
 
   uint32_t GetTimestamp() const;
 
-  uint8_t* Data() const;
+  uint8_t* Data();
 
   uint32_t Size() const;
 
@@ -38,22 +50,95 @@ class RtpStoragePacket {
 
   void SetResendMillisecs(uint64_t millisecs);
 
+  uint64_t GetSentMillisecs() const;
+
+  ResendPriority GetPriority() const;
+
  private:
+  friend class RtpPacketHistory;
   constexpr static uint32_t kRtxExtraSize = 2;
-  uint32_t ssrc_;
-  uint16_t sequence_number_;
-  uint32_t size_;
-  std::unique_ptr<uint8_t[]> data_;
+  bool stored_{false};
+  uint32_t ssrc_{0};
+  uint16_t sequence_number_{0};
+  uint32_t size_{0};
+  // Slot of the slab, filled from |group_| when the packet is looked up.
+  uint8_t* data_{nullptr};
   uint64_t resent_millisecs_{0};
+  uint64_t sent_millisecs_{0};
   uint32_t timestamp_{0};
   bool is_rtx_{false};
-  uint32_t header_offset_;
+  uint32_t header_offset_{0};
+  uint8_t payload_type_{0};
+  ResendPriority priority_{ResendPriority::kOther};
+  RtpPacketGroup::Pointer group_;
+  size_t index_{0};
 };
 
+/**
+ * @brief Sent packets of a track kept for retransmission.
+ *
+ * Packets live in a ring of slots backed by one slab, which is allocated the
+ * first time a packet has to be copied. The slot count is a power of two, so
+ * a sequence number keeps its slot across the 16 bit wraparound.
+ */
+class RtpPacketHistory {
+ public:
+  static constexpr uint32_t kSlotSize = PacketBuffer::kMtuSize;
+  static constexpr uint64_t kMinRetentionMillis = 1000;
+
+  explicit RtpPacketHistory(uint32_t capacity);
+
+  void SetRetentionMillis(uint64_t millis);
+
+  // Copies |pkt| into its slot.
+  void Put(const RtpPacket& pkt, ResendPriority priority, uint64_t now_millis);
+
+  // Refers to a packet of |group| that was sent with the given header fields.
+  void Put(uint32_t ssrc,
+           uint16_t sequence_number,
+           uint8_t payload_type,
+           RtpPacketGroup::Pointer group,
+           size_t index,
+           ResendPriority priority,
+           uint64_t now_millis);
+
+  /**
+   * @brief Look up a packet to resend.
+   *
+   * @return null if the slot was reused by another sequence number or the
+   * packet is older than the retention time.
+   */
+  RtpStoragePacket* Get(uint16_t sequence_number, uint64_t now_millis);
+
+  // Bytes allocated by this history, safe to call from any thread.
+  size_t MemoryUsage() const;
+
+ private:
+  uint8_t* SlotData(size_t index);
+
+  std::vector<RtpStoragePacket> slots_;
+  std::unique_ptr<uint8_t[]> slab_;
+  uint32_t mask_;
+  uint64_t retention_millis_{kMinRetentionMillis};
+  std::atomic<size_t> memory_usage_{0};
+};
+
+/**
+ * @brief One sent track of a viewer: sequence numbers, sender reports and
+ * NACK handling.
+ *
+ * Resends are paid from a token bucket credited with a share of every byte
+ * sent, so retransmissions can not grow the bitrate of a lossy viewer beyond
+ * that share. Within the budget keyframe packets go first, and packets that
+ * can no longer arrive before their frame is played out are not resent.
+ */
 class StreamTrack {
  public:
   static constexpr uint64_t kDefaultRttMillis = 100;
-  static constexpr uint32_t kSendBufferCapacity = 1000;
+  // Resends arriving later than this after the original are useless to the
+  // jitter buffer, unless the packet belongs to a keyframe.
+  static constexpr uint64_t kPlayoutDeadlineMillis = 400;
+  static constexpr int64_t kMaxResendBudgetBytes = 64 * 1024;
 
   class RtpParams {
    public:
@@ -68,11 +153,38 @@ class StreamTrack {
     bool is_nack_enable_{false};
     bool is_twcc_enable_{false};
     uint8_t twcc_extension_id_{0};
+    // Video only, FEC packets go in RED with the sequence numbers of the
+    // track.
+    bool is_ulpfec_enabled{false};
+    uint8_t ulpfec_payload_type{0};
+    // Audio only, previous Opus frames go in RED when there is loss.
+    bool is_red_enabled{false};
+    // RED of the m-line, for either of the above.
+    uint8_t red_payload_type{0};
+    // Sent in the SDES of every RTCP compound packet.
+    std::string cname;
   };
 
   class Observer {
    public:
-    virtual void OnStreamTrackResendPacket(RtpStoragePacket* pkt) = 0;
+    // |pkt| may be on the RTX SSRC already, |is_audio| is the kind of track.
+    virtual void OnStreamTrackResendPacket(RtpStoragePacket* pkt,
+                                           bool is_audio) = 0;
+  };
+
+  struct Stats {
+    // 0 until the first receiver report with a sender report reference.
+    uint64_t rtt_millis{0};
+    // Of the last receiver report, in 1/256.
+    uint8_t fraction_lost{0};
+    int32_t cumulative_lost{0};
+    uint32_t jitter_millis{0};
+    uint64_t nack_packets{0};
+    // Sequence numbers asked for by all NACK packets.
+    uint64_t nacked_packets{0};
+    // Resends, on the RTX stream when negotiated.
+    uint64_t resent_packets{0};
+    uint64_t resent_bytes{0};
   };
 
   StreamTrack(const RtpParams& params, Observer* observer);
@@ -82,32 +194,75 @@ class StreamTrack {
 
   void ReceiveReceiverReport(const ReportBlock& report_block);
 
-  void ReceiveNack(NackPacket* nack_packet);
+  void ReceiveNack(const RtcpNackView& nack);
 
+  // Gives |pkt| the next sequence number of the track and stores it.
   void ReceivePacket(RtpPacket* pkt);
 
+  /**
+   * @brief Write the header of a packet of |group| for this track into
+   * |header| and account it as sent.
+   */
+  void ReceiveSharedPacket(const RtpPacketGroup::Pointer& group,
+                           size_t index,
+                           uint8_t* header);
+
+  // Account a FEC packet of |size| bytes and return its sequence number.
+  uint16_t ReceiveFecPacket(uint32_t size);
+
+  size_t GetRetransmissionMemory() const;
+
+  uint64_t GetRttMillis() const;
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
  private:
+  void AddResendBudget(uint32_t size);
+
+  ResendPriority GetResendPriority(const uint8_t* payload, size_t size) const;
+
   uint32_t max_rtp_timestamp_{0};
   uint32_t max_packet_millis_{0};
   uint64_t rtt_{kDefaultRttMillis};
-  std::array<std::unique_ptr<RtpStoragePacket>, kSendBufferCapacity>
-      send_buffer_;
   RtpParams params_;
   Observer* observer_;
-  uint32_t max_resend_delay_in_clock_rate_;
+  RtpPacketHistory packet_history_;
   uint32_t send_packet_count_{0};
   uint32_t send_octets_{0};
   uint16_t rtx_sequence_number_{0};
+  uint16_t sequence_number_{0};
+  // 0 if resends are not limited.
+  double resend_budget_ratio_;
+  int64_t resend_budget_bytes_{0};
+  std::vector<RtpStoragePacket*> resend_packets_;
+  std::atomic<uint64_t> stats_rtt_millis_{0};
+  std::atomic<uint8_t> stats_fraction_lost_{0};
+  std::atomic<int32_t> stats_cumulative_lost_{0};
+  std::atomic<uint32_t> stats_jitter_millis_{0};
+  std::atomic<uint64_t> stats_nack_packets_{0};
+  std::atomic<uint64_t> stats_nacked_packets_{0};
+  std::atomic<uint64_t> stats_resent_packets_{0};
+  std::atomic<uint64_t> stats_resent_bytes_{0};
 };
 
 class MediaStream : public StreamTrack::Observer,
                    public Timer::Listener,
-                   public RtpPacketizer::Observer {
+                   public RtpPacketizer::Observer,
+                   public Pacer::Observer,
+                   public RtcpParser::Visitor {
  public:
   class Observer {
    public:
     virtual void OnRtcpPacketSend(uint8_t* data, int size) = 0;
-    virtual void OnRtpPacketSend(uint8_t* data, int size) = 0;
+    // |buffer| has room for the SRTP trailer and may be encrypted in place.
+    virtual void OnRtpPacketSend(PacketBuffer::Pointer buffer,
+                                 bool is_audio) = 0;
+    // Called when TWCC is negotiated and after every transport feedback, or
+    // on REMB without TWCC.
+    virtual void OnTargetBitrateUpdate(uint32_t bitrate) = 0;
+    // The viewer sent PLI or FIR, answer with RedeliverKeyframe.
+    virtual void OnKeyframeRequest() = 0;
   };
 
   MediaStream(boost::asio::io_context& io_context, Observer* observer);
@@ -120,21 +275,127 @@ class MediaStream : public StreamTrack::Observer,
 
   void ReceiveRctp(uint8_t* data, int len);
 
+  /**
+   * @brief Send the cached GOP of the source again, as new frames right
+   * after the last one sent. Only the keyframe is sent if the GOP is too
+   * large, later frames then decode with errors until the next keyframe.
+   *
+   * @param packets Media packets since the last keyframe of the source,
+   * nothing is sent unless the last video packet this stream got is one of
+   * them.
+   */
+  void RedeliverKeyframe(const std::list<MediaPacket::Pointer>& packets);
+
+  // Memory held for NACK by all tracks, safe to call from any thread.
+  size_t GetRetransmissionMemory() const;
+
+  // Safe to call from any thread, all zero without pacing.
+  Pacer::Stats GetPacerStats() const;
+
+  // Safe to call from any thread, all zero without thinning.
+  H264Thinner::Stats GetThinningStats() const;
+
+  // Safe to call from any thread, all zero without such a track.
+  StreamTrack::Stats GetVideoStats() const;
+  StreamTrack::Stats GetAudioStats() const;
+
+  // Bits per second sent between the last two RTCP reports, resends and
+  // FEC included. Safe to call from any thread.
+  uint32_t GetEgressBitrate() const;
+
   void Stop();
 
  private:
+  // Keyframe requests closer than this, or two RTTs, are ignored while the
+  // redelivered keyframe is on its way.
+  static constexpr int64_t kMinRedeliveryIntervalMillis = 500;
+  static constexpr size_t kMaxRedeliveryBytes = 512 * 1024;
+  static constexpr uint64_t kInitialRtcpDelayMillis = 200;
+  // RTCP gets 5% of the session bandwidth, measured as the bitrate sent
+  // since the last report but at least the minimum.
+  static constexpr double kRtcpBandwidthFraction = 0.05;
+  static constexpr double kMinSessionBitrate = 64000;
+  static constexpr double kMaxRtcpIntervalMillis = 5000;
+  // IP and UDP headers count towards the RTCP packet size.
+  static constexpr size_t kRtcpOverheadBytes = 28;
+
   void RtpPacketSent(RtpPacket* pkt);
 
-  void OnStreamTrackResendPacket(RtpStoragePacket* pkt) override;
+  void SendRtpPacketGroup(uint32_t ssrc, const RtpPacketGroup::Pointer& group);
+
+  // Goes through the pacer when pacing is enabled, audio in RED when
+  // redundancy is on.
+  void SendRtpPacket(uint32_t ssrc, PacketBuffer::Pointer buffer);
+
+  void PaceRtpPacket(PacketBuffer::Pointer buffer, bool is_audio);
+
+  // Sends a video packet in RED, followed by the FEC packets it completes.
+  void SendProtectedVideoPacket(PacketBuffer::Pointer buffer);
+
+  // Stamps the transport-wide sequence number when TWCC is negotiated, so
+  // the send time is the time the packet leaves the pacer.
+  void OnPacerPacketSend(PacketBuffer::Pointer buffer, bool is_audio) override;
+
+  // Resends go out as they are, without FEC, RED or redundancy.
+  void OnStreamTrackResendPacket(RtpStoragePacket* pkt,
+                                 bool is_audio) override;
 
   void OnRtpPacketGenerated(RtpPacket* pkt) override;
 
+  // Sends one compound packet: a SR per track that sent media and the SDES.
   void OnTimerTimeout() override;
 
+  // RFC 3550 section 6.3.1 with the reduced minimum of section 6.2.
+  uint64_t NextRtcpIntervalMillis(int64_t now_millis);
+
+  void ReceiveKeyframeRequest();
+
+  void UpdateTargetBitrate(uint32_t target_bitrate);
+
+  void OnReportBlock(const ReportBlock& report_block) override;
+
+  void OnNack(const RtcpNackView& nack) override;
+
+  void OnPli(uint32_t media_ssrc) override;
+
+  void OnFir(uint32_t media_ssrc) override;
+
+  void OnRemb(uint64_t bitrate) override;
+
+  void OnTransportFeedback(const RtcpTransportFeedbackView& feedback) override;
+
   boost::asio::io_context& io_context_;
   std::unordered_map<uint32_t, std::unique_ptr<StreamTrack>> stream_tracks_;
   std::unique_ptr<Timer> rtcp_timer_;
+  Random random_;
+  std::string cname_;
+  double average_rtcp_size_{0};
+  bool rtcp_sent_{false};
+  int64_t last_rtcp_millis_{0};
+  // Bytes sent since |last_rtcp_millis_|.
+  uint64_t sent_bytes_{0};
+  std::atomic<uint32_t> stats_egress_bitrate_{0};
   std::unique_ptr<H264RtpPacketizer> h264_packetizer_;
   std::unique_ptr<OpusRtpPacketizer> opus_packetizer_;
+  uint32_t video_ssrc_{0};
+  uint32_t audio_ssrc_{0};
+  uint8_t twcc_extension_id_{0};
+  uint16_t transport_sequence_number_{0};
+  std::unique_ptr<BandwidthEstimator> bandwidth_estimator_;
+  // Reused for every transport feedback.
+  std::vector<RtcpTransportFeedbackView::PacketResult> packet_results_;
+  std::unique_ptr<Pacer> pacer_;
+  std::unique_ptr<H264Thinner> h264_thinner_;
+  std::unique_ptr<UlpfecGenerator> ulpfec_generator_;
+  uint8_t red_payload_type_{0};
+  uint8_t ulpfec_payload_type_{0};
+  std::unique_ptr<AudioRedEncoder> audio_red_encoder_;
+  // Redelivery stops here, later packets are still on their way.
+  MediaPacket::Pointer last_video_packet_;
+  uint32_t last_video_timestamp_{0};
+  // Timestamp of the frame being redelivered, while |redelivering_|.
+  uint32_t redelivery_timestamp_{0};
+  bool redelivering_{false};
+  int64_t last_redelivery_millis_{-1};
   Observer* observer_;
 };
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "metrics.h"
+
+#include <utility>
+#include <vector>
+
+#include "media_source_manager.h"
+
+static void AppendFamily(std::string* out,
+                         const std::string& name,
+                         const char* type,
+                         const char* help) {
+  *out += "# HELP " + name + " " + help + "\n";
+  *out += "# TYPE " + name + " " + type + "\n";
+}
+
+template <typename T>
+static void AppendSample(std::string* out,
+                         const std::string& name,
+                         const std::string& labels,
+                         T value) {
+  *out += name;
+  if (!labels.empty())
+    *out += "{" + labels + "}";
+  *out += " " + std::to_string(value) + "\n";
+}
+
+static std::string StreamLabel(const std::string& id) {
+  std::string label = "stream=\"";
+  for (char c : id) {
+    if (c == '\\' || c == '"')
+      label += '\\';
+    if (c == '\n')
+      label += "\\n";
+    else
+      label += c;
+  }
+  return label + "\"";
+}
+
+size_t MetricCounter::ShardIndex() {
+  static std::atomic<size_t> next_thread{0};
+  thread_local size_t index =
+      next_thread.fetch_add(1, std::memory_order_relaxed) % kShards;
+  return index;
+}
+
+int64_t MetricCounter::Value() const {
+  int64_t value = 0;
+  for (auto& shard : shards_)
+    value += shard.value.load(std::memory_order_relaxed);
+  return value;
+}
+
+const int64_t MetricHistogram::kBucketMillis[kBuckets - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000};
+
+void MetricHistogram::Observe(int64_t millis) {
+  size_t bucket = 0;
+  while (bucket < kBuckets - 1 && millis > kBucketMillis[bucket])
+    ++bucket;
+  buckets_[bucket].Add(1);
+  sum_millis_.Add(millis);
+}
+
+void MetricHistogram::Export(const std::string& name, std::string* out) const {
+  int64_t count = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    count += buckets_[i].Value();
+    std::string le = i < kBuckets - 1
+                         ? std::to_string(kBucketMillis[i] / 1000.0)
+                         : std::string("+Inf");
+    AppendSample(out, name + "_bucket", "le=\"" + le + "\"", count);
+  }
+  AppendSample(out, name + "_sum", "", sum_millis_.Value() / 1000.0);
+  AppendSample(out, name + "_count", "", count);
+}
+
+Metrics& Metrics::GetInstance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+std::string Metrics::Export() {
+  std::string out;
+  AppendFamily(&out, "wss_viewers", "gauge", "WebRTC viewers of this node.");
+  AppendSample(&out, "wss_viewers", "", viewers.Value());
+  AppendFamily(&out, "wss_egress_packets_total", "counter",
+               "UDP datagrams sent.");
+  AppendSample(&out, "wss_egress_packets_total", "", egress_packets.Value());
+  AppendFamily(&out, "wss_egress_bytes_total", "counter", "UDP bytes sent.");
+  AppendSample(&out, "wss_egress_bytes_total", "", egress_bytes.Value());
+  AppendFamily(&out, "wss_udp_send_queue_packets", "gauge",
+               "Datagrams waiting in the send queues of the UDP sockets.");
+  AppendSample(&out, "wss_udp_send_queue_packets", "",
+               udp_send_queue_packets.Value());
+  AppendFamily(&out, "wss_retransmitted_packets_total", "counter",
+               "RTP packets resent on NACK.");
+  AppendSample(&out, "wss_retransmitted_packets_total", "",
+               retransmitted_packets.Value());
+  AppendFamily(&out, "wss_retransmitted_bytes_total", "counter",
+               "RTP bytes resent on NACK.");
+  AppendSample(&out, "wss_retransmitted_bytes_total", "",
+               retransmitted_bytes.Value());
+  AppendFamily(&out, "wss_srtp_failures_total", "counter",
+               "Packets SRTP failed to protect or unprotect.");
+  AppendSample(&out, "wss_srtp_failures_total", "operation=\"protect\"",
+               srtp_protect_failures.Value());
+  AppendSample(&out, "wss_srtp_failures_total", "operation=\"unprotect\"",
+               srtp_unprotect_failures.Value());
+  AppendFamily(&out, "wss_dtls_handshake_duration_seconds", "histogram",
+               "Time from the start of the DTLS handshake to its end.");
+  dtls_handshake_duration.Export("wss_dtls_handshake_duration_seconds", &out);
+
+  std::vector<std::pair<std::string, MediaSource::Stats>> streams;
+  for (auto& item : MediaSourceManager::GetInstance().List()) {
+    std::string id = item["id"];
+    auto media_source = MediaSourceManager::GetInstance().Query(id);
+    if (media_source)
+      streams.emplace_back(StreamLabel(id), media_source->GetStats());
+  }
+  AppendFamily(&out, "wss_stream_ingest_bytes_total", "counter",
+               "Bytes read from the source, rate() is the ingest bitrate.");
+  for (auto& stream : streams)
+    AppendSample(&out, "wss_stream_ingest_bytes_total", stream.first,
+                 stream.second.ingest_bytes);
+  AppendFamily(&out, "wss_stream_video_frames_total", "counter",
+               "Video frames read from the source, rate() is the fps.");
+  for (auto& stream : streams)
+    AppendSample(&out, "wss_stream_video_frames_total", stream.first,
+                 stream.second.video_frames);
+  AppendFamily(&out, "wss_stream_gop_frames", "gauge",
+               "Video frames of the last complete GOP.");
+  for (auto& stream : streams)
+    AppendSample(&out, "wss_stream_gop_frames", stream.first,
+                 stream.second.gop_frames);
+  AppendFamily(&out, "wss_stream_opus_transcode_seconds", "summary",
+               "Time spent transcoding audio packets to Opus.");
+  for (auto& stream : streams) {
+    AppendSample(&out, "wss_stream_opus_transcode_seconds_sum", stream.first,
+                 stream.second.transcode_micros / 1000000.0);
+    AppendSample(&out, "wss_stream_opus_transcode_seconds_count",
+                 stream.first, stream.second.transcodes);
+  }
+  return out;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief A counter each thread adds to without contention.
+ *
+ * Threads are spread over cache line sized shards, an update is one relaxed
+ * atomic add to the shard of the thread and the shards are only summed when
+ * read. Adding negative values makes it a gauge.
+ */
+class MetricCounter {
+ public:
+  void Add(int64_t value) {
+    shards_[ShardIndex()].value.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  int64_t Value() const;
+
+ private:
+  static constexpr size_t kShards = 16;
+
+  struct alignas(64) Shard {
+    std::atomic<int64_t> value{0};
+  };
+
+  static size_t ShardIndex();
+
+  Shard shards_[kShards];
+};
+
+// Cumulative buckets of millisecond durations, like a Prometheus histogram.
+class MetricHistogram {
+ public:
+  static constexpr size_t kBuckets = 8;
+
+  void Observe(int64_t millis);
+
+  // Writes the bucket, sum and count series of |name|, in seconds.
+  void Export(const std::string& name, std::string* out) const;
+
+ private:
+  // Upper bounds, the last one is +Inf.
+  static const int64_t kBucketMillis[kBuckets - 1];
+
+  MetricCounter buckets_[kBuckets];
+  MetricCounter sum_millis_;
+};
+
+/**
+ * @brief Counters of the whole node, exported by GET /metrics in the
+ * Prometheus text format.
+ */
+class Metrics {
+ public:
+  static Metrics& GetInstance();
+
+  MetricCounter viewers;
+  // Datagrams and bytes that left the UDP sockets.
+  MetricCounter egress_packets;
+  MetricCounter egress_bytes;
+  // Datagrams waiting in the send queues of all UDP sockets.
+  MetricCounter udp_send_queue_packets;
+  MetricCounter retransmitted_packets;
+  MetricCounter retransmitted_bytes;
+  MetricCounter srtp_protect_failures;
+  MetricCounter srtp_unprotect_failures;
+  MetricHistogram dtls_handshake_duration;
+
+  /**
+   * @brief Render the node counters and the ingest of every stream.
+   *
+   * @return Text exposition format 0.0.4.
+   */
+  std::string Export();
+
+ private:
+  Metrics() = default;
+};
@@ -0,0 +1,137 @@
+#include "pacer.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+Pacer::Pacer(boost::asio::io_context& io_context,
+             double pacing_factor,
+             Observer* observer)
+    : timer_{io_context, this},
+      pacing_factor_{pacing_factor},
+      observer_{observer} {}
+
+void Pacer::Enqueue(PacketBuffer::Pointer buffer, bool is_audio) {
+  int64_t now_millis = TimeMillis();
+  if (window_start_millis_ < 0)
+    window_start_millis_ = now_millis;
+  window_bytes_ += buffer->Size();
+  if (now_millis - window_start_millis_ >=
+      static_cast<int64_t>(kBitrateWindowMillis)) {
+    media_bitrate_ = static_cast<uint32_t>(
+        window_bytes_ * 8 * 1000 / (now_millis - window_start_millis_));
+    window_bytes_ = 0;
+    window_start_millis_ = now_millis;
+  }
+
+  queued_bytes_ += buffer->Size();
+  auto& queue = is_audio ? audio_queue_ : video_queue_;
+  queue.push_back({std::move(buffer), is_audio, now_millis});
+  // Otherwise the pending timeout sends it.
+  if (!timer_scheduled_)
+    Process();
+  else
+    UpdateStats(PacingBitrate(now_millis), now_millis);
+}
+
+void Pacer::SetTargetBitrate(uint32_t bitrate) {
+  target_bitrate_ = bitrate;
+}
+
+Pacer::Stats Pacer::GetStats() const {
+  Stats stats;
+  stats.pacing_bitrate = stats_pacing_bitrate_.load(std::memory_order_relaxed);
+  stats.queued_packets = stats_queued_packets_.load(std::memory_order_relaxed);
+  stats.queued_bytes = stats_queued_bytes_.load(std::memory_order_relaxed);
+  stats.queue_delay_millis =
+      stats_queue_delay_millis_.load(std::memory_order_relaxed);
+  stats.average_queue_delay_millis =
+      stats_average_queue_delay_millis_.load(std::memory_order_relaxed);
+  stats.max_queue_delay_millis =
+      stats_max_queue_delay_millis_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void Pacer::Process() {
+  int64_t now_millis = TimeMillis();
+  uint32_t bitrate = PacingBitrate(now_millis);
+  int64_t max_budget =
+      std::max<int64_t>(static_cast<int64_t>(bitrate) * kMaxBurstMillis / 8000,
+                        PacketBuffer::kMtuSize);
+  if (last_process_millis_ < 0) {
+    budget_bytes_ = max_budget;
+  } else {
+    budget_bytes_ += static_cast<int64_t>(bitrate) *
+                     (now_millis - last_process_millis_) / 8000;
+    budget_bytes_ = std::min(budget_bytes_, max_budget);
+  }
+  last_process_millis_ = now_millis;
+
+  // The last packet may overdraw the budget, the debt is paid off before
+  // the next one goes out.
+  while (budget_bytes_ > 0 &&
+         (!audio_queue_.empty() || !video_queue_.empty())) {
+    auto& queue = audio_queue_.empty() ? video_queue_ : audio_queue_;
+    QueuedPacket packet = std::move(queue.front());
+    queue.pop_front();
+    budget_bytes_ -= packet.buffer->Size();
+    SendPacket(std::move(packet), now_millis);
+  }
+
+  UpdateStats(bitrate, now_millis);
+  if (!audio_queue_.empty() || !video_queue_.empty()) {
+    timer_scheduled_ = true;
+    timer_.AsyncWait(kProcessIntervalMillis);
+  }
+}
+
+void Pacer::SendPacket(QueuedPacket packet, int64_t now_millis) {
+  uint32_t delay = static_cast<uint32_t>(now_millis - packet.enqueue_millis);
+  average_queue_delay_millis_ =
+      0.9 * average_queue_delay_millis_ + 0.1 * delay;
+  max_queue_delay_millis_ = std::max(max_queue_delay_millis_, delay);
+  queued_bytes_ -= packet.buffer->Size();
+  observer_->OnPacerPacketSend(std::move(packet.buffer), packet.is_audio);
+}
+
+int64_t Pacer::OldestEnqueueMillis(int64_t now_millis) const {
+  int64_t oldest = now_millis;
+  if (!audio_queue_.empty())
+    oldest = std::min(oldest, audio_queue_.front().enqueue_millis);
+  if (!video_queue_.empty())
+    oldest = std::min(oldest, video_queue_.front().enqueue_millis);
+  return oldest;
+}
+
+uint32_t Pacer::PacingBitrate(int64_t now_millis) const {
+  uint32_t base_bitrate = target_bitrate_;
+  if (base_bitrate == 0)
+    base_bitrate = media_bitrate_ != 0 ? media_bitrate_ : kDefaultBitrate;
+  double bitrate = base_bitrate * pacing_factor_;
+
+  // Whatever the estimate says, do not let packets wait longer than
+  // kMaxQueueMillis, they would be useless by then.
+  int64_t waited = now_millis - OldestEnqueueMillis(now_millis);
+  int64_t time_left = std::max<int64_t>(kMaxQueueMillis - waited,
+                                        kProcessIntervalMillis);
+  double drain_bitrate = queued_bytes_ * 8.0 * 1000 / time_left;
+  return static_cast<uint32_t>(std::max(bitrate, drain_bitrate));
+}
+
+void Pacer::UpdateStats(uint32_t bitrate, int64_t now_millis) {
+  stats_pacing_bitrate_.store(bitrate, std::memory_order_relaxed);
+  stats_queued_packets_.store(audio_queue_.size() + video_queue_.size(),
+                              std::memory_order_relaxed);
+  stats_queued_bytes_.store(queued_bytes_, std::memory_order_relaxed);
+  stats_queue_delay_millis_.store(
+      now_millis - OldestEnqueueMillis(now_millis), std::memory_order_relaxed);
+  stats_average_queue_delay_millis_.store(average_queue_delay_millis_,
+                                          std::memory_order_relaxed);
+  stats_max_queue_delay_millis_.store(max_queue_delay_millis_,
+                                      std::memory_order_relaxed);
+}
+
+void Pacer::OnTimerTimeout() {
+  timer_scheduled_ = false;
+  Process();
+}
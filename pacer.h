@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include "packet_buffer.h"
+#include "timer.h"
+
+/**
+ * @brief Releases the RTP packets of one viewer at a steady rate.
+ *
+ * A token bucket refilled at the pacing rate spreads a keyframe over time
+ * instead of bursting it into the socket. Audio is sent ahead of queued
+ * video. The pacing rate is a multiple of the bandwidth estimate, or of the
+ * measured media bitrate while there is none. Runs on the loop of the
+ * transport, except GetStats.
+ */
+class Pacer : public Timer::Listener {
+ public:
+  class Observer {
+   public:
+    virtual void OnPacerPacketSend(PacketBuffer::Pointer buffer,
+                                   bool is_audio) = 0;
+  };
+
+  struct Stats {
+    uint32_t pacing_bitrate{0};
+    uint32_t queued_packets{0};
+    uint32_t queued_bytes{0};
+    // Time the oldest queued packet has waited.
+    uint32_t queue_delay_millis{0};
+    // Smoothed and worst wait of the packets sent so far.
+    uint32_t average_queue_delay_millis{0};
+    uint32_t max_queue_delay_millis{0};
+  };
+
+  Pacer(boost::asio::io_context& io_context,
+        double pacing_factor,
+        Observer* observer);
+
+  void Enqueue(PacketBuffer::Pointer buffer, bool is_audio);
+
+  // 0 falls back to the measured media bitrate.
+  void SetTargetBitrate(uint32_t bitrate);
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
+ private:
+  static constexpr uint32_t kDefaultBitrate = 1000000;
+  static constexpr uint64_t kProcessIntervalMillis = 5;
+  // Budget that may build up while idle.
+  static constexpr uint64_t kMaxBurstMillis = 10;
+  // The rate is raised as needed to send everything queued within this time.
+  static constexpr uint64_t kMaxQueueMillis = 1000;
+  static constexpr uint64_t kBitrateWindowMillis = 500;
+
+  struct QueuedPacket {
+    PacketBuffer::Pointer buffer;
+    bool is_audio;
+    int64_t enqueue_millis;
+  };
+
+  void Process();
+  void SendPacket(QueuedPacket packet, int64_t now_millis);
+  int64_t OldestEnqueueMillis(int64_t now_millis) const;
+  uint32_t PacingBitrate(int64_t now_millis) const;
+  void UpdateStats(uint32_t bitrate, int64_t now_millis);
+  void OnTimerTimeout() override;
+
+  Timer timer_;
+  bool timer_scheduled_{false};
+  double pacing_factor_;
+  Observer* observer_;
+  std::deque<QueuedPacket> audio_queue_;
+  std::deque<QueuedPacket> video_queue_;
+  size_t queued_bytes_{0};
+  int64_t budget_bytes_{0};
+  int64_t last_process_millis_{-1};
+  uint32_t target_bitrate_{0};
+  uint32_t media_bitrate_{0};
+  size_t window_bytes_{0};
+  int64_t window_start_millis_{-1};
+  double average_queue_delay_millis_{0};
+  uint32_t max_queue_delay_millis_{0};
+
+  std::atomic<uint32_t> stats_pacing_bitrate_{0};
+  std::atomic<uint32_t> stats_queued_packets_{0};
+  std::atomic<uint32_t> stats_queued_bytes_{0};
+  std::atomic<uint32_t> stats_queue_delay_millis_{0};
+  std::atomic<uint32_t> stats_average_queue_delay_millis_{0};
+  std::atomic<uint32_t> stats_max_queue_delay_millis_{0};
+};
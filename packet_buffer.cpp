@@ -0,0 +1,53 @@
+#include "packet_buffer.h"
+
+void PacketBuffer::Releaser::operator()(PacketBuffer* buffer) const {
+  PacketBufferPool::GetInstance().Release(buffer);
+}
+
+PacketBuffer::PacketBuffer(size_t capacity)
+    : data_{new uint8_t[capacity]}, capacity_{capacity} {}
+
+uint8_t* PacketBuffer::Data() {
+  return data_.get();
+}
+
+const uint8_t* PacketBuffer::Data() const {
+  return data_.get();
+}
+
+size_t PacketBuffer::Size() const {
+  return size_;
+}
+
+void PacketBuffer::SetSize(size_t size) {
+  size_ = size;
+}
+
+size_t PacketBuffer::Capacity() const {
+  return capacity_;
+}
+
+PacketBufferPool& PacketBufferPool::GetInstance() {
+  // Never destroyed, buffers still come back while other singletons are
+  // destroyed at exit.
+  static PacketBufferPool* packet_buffer_pool = new PacketBufferPool;
+  return *packet_buffer_pool;
+}
+
+PacketBuffer::Pointer PacketBufferPool::Acquire(size_t capacity) {
+  PacketBuffer* buffer = nullptr;
+  if (capacity > PacketBuffer::kDefaultCapacity)
+    buffer = new PacketBuffer(capacity);
+  else if (!free_buffers_.pop(buffer))
+    buffer = new PacketBuffer(PacketBuffer::kDefaultCapacity);
+  buffer->SetSize(0);
+  return PacketBuffer::Pointer(buffer);
+}
+
+void PacketBufferPool::Release(PacketBuffer* buffer) {
+  if (!buffer)
+    return;
+  if (buffer->Capacity() != PacketBuffer::kDefaultCapacity ||
+      !free_buffers_.push(buffer))
+    delete buffer;
+}
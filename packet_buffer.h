@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <boost/lockfree/stack.hpp>
+
+/**
+ * @brief A datagram buffer that goes back to PacketBufferPool when released.
+ *
+ * The default capacity is an MTU plus the largest SRTP/SRTCP trailer, so a
+ * packet can be encrypted in place and handed to the socket without a copy.
+ */
+class PacketBuffer {
+ public:
+  static constexpr size_t kMtuSize = 1500;
+  // SRTP_MAX_TRAILER_LEN of libsrtp.
+  static constexpr size_t kSrtpTrailerSize = 144;
+  static constexpr size_t kDefaultCapacity = kMtuSize + kSrtpTrailerSize;
+
+  class Releaser {
+   public:
+    void operator()(PacketBuffer* buffer) const;
+  };
+  using Pointer = std::unique_ptr<PacketBuffer, Releaser>;
+
+  explicit PacketBuffer(size_t capacity);
+
+  uint8_t* Data();
+  const uint8_t* Data() const;
+  size_t Size() const;
+  void SetSize(size_t size);
+  size_t Capacity() const;
+
+ private:
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_;
+  size_t size_{0};
+};
+
+/**
+ * @brief Recycles default sized packet buffers, safe to use from any thread.
+ */
+class PacketBufferPool {
+ public:
+  static PacketBufferPool& GetInstance();
+
+  /**
+   * @brief Get an empty buffer that holds at least |capacity| bytes.
+   *
+   * Only buffers of the default capacity are recycled, larger ones are
+   * allocated and freed every time.
+   */
+  PacketBuffer::Pointer Acquire(
+      size_t capacity = PacketBuffer::kDefaultCapacity);
+
+ private:
+  friend class PacketBuffer::Releaser;
+  static constexpr size_t kMaxFreeBuffers = 8192;
+
+  PacketBufferPool() = default;
+  void Release(PacketBuffer* buffer);
+
+  boost::lockfree::stack<PacketBuffer*,
+                         boost::lockfree::capacity<kMaxFreeBuffers>>
+      free_buffers_;
+};
@@ -2,8 +2,6 @@
 
 #include <arpa/inet.h>
 
-#include "spdlog/spdlog.h"
-
 bool RtcpPacket::Parse(ByteReader* byte_reader) {
   if (!ParseCommonHeader(byte_reader))
     return false;
@@ -137,151 +135,71 @@ bool SenderReportPacket::Serialize(ByteWriter* byte_writer) {
   return true;
 }
 
-void SenderReportPacket::SetSenderSsrc(uint32_t sender_ssrc) {
-  sender_ssrc_ = sender_ssrc;
-}
-
-void SenderReportPacket::SetNtpSeconds(uint32_t ntp_seconds) {
-  ntp_seconds_ = ntp_seconds;
-}
-
-void SenderReportPacket::SetNtpFractions(uint32_t ntp_fractions) {
-  ntp_fractions_ = ntp_fractions;
-}
-
-void SenderReportPacket::SetRtpTimestamp(uint32_t rtp_timestamp) {
-  rtp_timestamp_ = rtp_timestamp;
-}
-
-void SenderReportPacket::SetSendPacketCount(uint32_t send_packet_count) {
-  send_packet_count_ = send_packet_count;
-}
-
-void SenderReportPacket::SendOctets(uint32_t send_octets) {
-  send_octets_ = send_octets;
-}
-
-bool ReceiverReportPacket::Parse(ByteReader* byte_reader) {
-  if (!ParseCommonHeader(byte_reader))
+bool SdesPacket::Serialize(ByteWriter* byte_writer) {
+  //  0                   1                   2                   3
+  //  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |                         SSRC/CSRC_1                           |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |    CNAME=1    |     length    | user and domain name        ...
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // Every chunk ends with a null item and is padded to 32 bits.
+  if (chunks_.empty() || chunks_.size() > kMaxChunks)
     return false;
-  if (!byte_reader->ReadUInt32(&sender_ssrc_))
+  size_t length = sizeof(header_);
+  for (auto& chunk : chunks_)
+    length += (4 + 2 + chunk.second.size() + 1 + 3) / 4 * 4;
+
+  header_.count_or_format = chunks_.size();
+  header_.packet_type = kRtcpTypeSdes;
+  header_.padding = 0;
+  header_.version = 2;
+  header_.length = length / 4 - 1;
+  if (!SerializeCommonHeader(byte_writer))
     return false;
-  for (int i = 0; i < Count(); ++i) {
-    ReportBlock block;
-    if (!byte_reader->ReadUInt32(&block.source_ssrc))
-      return false;
-    if (!byte_reader->ReadUInt8(&block.fraction_lost))
+  for (auto& chunk : chunks_) {
+    if (!byte_writer->WriteUInt32(chunk.first))
       return false;
-    if (!byte_reader->ReadUInt24(&block.cumulative_lost))
+    if (!byte_writer->WriteUInt8(kCnameItem))
       return false;
-    if (!byte_reader->ReadUInt32(&block.extended_high_seq_num))
+    if (!byte_writer->WriteUInt8(chunk.second.size()))
       return false;
-    if (!byte_reader->ReadUInt32(&block.jitter))
+    if (!byte_writer->WriteBytes(chunk.second.data(), chunk.second.size()))
       return false;
-    if (!byte_reader->ReadUInt32(&block.last_sr))
-      return false;
-    if (!byte_reader->ReadUInt32(&block.delay_since_last_sr))
-      return false;
-    report_blocks_.push_back(block);
+    size_t padding = 4 - (4 + 2 + chunk.second.size()) % 4;
+    for (size_t i = 0; i < padding; ++i) {
+      if (!byte_writer->WriteUInt8(0))
+        return false;
+    }
   }
   return true;
 }
 
-std::vector<ReportBlock> ReceiverReportPacket::GetReportBlocks() const {
-  return report_blocks_;
-}
-
-bool RtpfbPacket::ParseCommonPeedback(ByteReader* byte_reader) {
-  if (!byte_reader->ReadUInt32(&sender_ssrc_))
-    return false;
-  if (!byte_reader->ReadUInt32(&media_ssrc_))
-    return false;
-  return true;
-}
-
-uint32_t RtpfbPacket::GetMediaSsrc() {
-  return media_ssrc_;
+void SdesPacket::AddCname(uint32_t ssrc, const std::string& cname) {
+  // The length field is one byte.
+  chunks_.emplace_back(ssrc, cname.substr(0, 255));
 }
 
-bool RtpfbPacket::Parse(ByteReader* byte_reader) {
-  if (!ParseCommonHeader(byte_reader))
-    return false;
-  if (!ParseCommonPeedback(byte_reader))
-    return false;
-  int payload_len = header_.length * 4;
-  if (!byte_reader->Consume(payload_len - kCommonFeedbackLength))
-    return false;
-  return true;
+void SenderReportPacket::SetSenderSsrc(uint32_t sender_ssrc) {
+  sender_ssrc_ = sender_ssrc;
 }
 
-std::vector<uint16_t> NackPacket::GetLostPacketSequenceNumbers() {
-  return packet_lost_sequence_numbers_;
+void SenderReportPacket::SetNtpSeconds(uint32_t ntp_seconds) {
+  ntp_seconds_ = ntp_seconds;
 }
 
-bool NackPacket::Parse(ByteReader* byte_reader) {
-  if (!ParseCommonHeader(byte_reader))
-    return false;
-  if (!ParseCommonPeedback(byte_reader))
-    return false;
-  int payload_len = header_.length * 4;
-  size_t nack_items = (payload_len - kCommonFeedbackLength) / kNackItemLength;
-
-  uint16_t pid = 0, blp = 0;
-  for (size_t index = 0; index < nack_items; ++index) {
-    if (!byte_reader->ReadUInt16(&pid))
-      return false;
-    if (!byte_reader->ReadUInt16(&blp))
-      return false;
-    packet_lost_sequence_numbers_.push_back(pid);
-
-    pid = pid + 1;
-    for (uint16_t bitmask = blp; bitmask != 0; bitmask >>= 1, ++pid) {
-      if (bitmask & 1)
-        packet_lost_sequence_numbers_.push_back(pid);
-    }
-  }
-
-  return true;
+void SenderReportPacket::SetNtpFractions(uint32_t ntp_fractions) {
+  ntp_fractions_ = ntp_fractions;
 }
 
-bool RtcpCompound::Parse(uint8_t* data, int size) {
-  ByteReader byte_reader(data, size);
-
-  while (byte_reader.Left() >= 2) {
-    RtcpPacket* packet = nullptr;
-    RtcpCommonHeader* header = (RtcpCommonHeader*)byte_reader.CurrentData();
-    if (header->packet_type == kRtcpTypeRtpfb) {
-      if (1 == header->count_or_format) {
-        packet = new NackPacket;
-      } else {
-        packet = new RtcpPacket;
-      }
-
-      // if(15 == header->count_or_format)
-      // spdlog::info("Incomming TWCC packet.");
-    } else if (header->packet_type == kRtcpTypeRr) {
-      packet = new ReceiverReportPacket;
-    } else {
-      packet = new RtcpPacket;
-    }
-
-    if (!packet->Parse(&byte_reader)) {
-      spdlog::warn("rtcp packet parse error.");
-      return false;
-    }
-    rtcps_.push_back(packet);
-  }
-
-  return true;
+void SenderReportPacket::SetRtpTimestamp(uint32_t rtp_timestamp) {
+  rtp_timestamp_ = rtp_timestamp;
 }
 
-std::vector<RtcpPacket*> RtcpCompound::GetRtcpPackets() {
-  return rtcps_;
+void SenderReportPacket::SetSendPacketCount(uint32_t send_packet_count) {
+  send_packet_count_ = send_packet_count;
 }
 
-RtcpCompound::~RtcpCompound() {
-  for (auto p : rtcps_) {
-    if (p)
-      delete p;
-  }
+void SenderReportPacket::SendOctets(uint32_t send_octets) {
+  send_octets_ = send_octets;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <cstddef>
 #include <set>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "byte_buffer.h"
@@ -91,84 +93,15 @@ class SenderReportPacket : public RtcpPacket {
   uint32_t send_octets_;
 };
 
-class ReceiverReportPacket : public RtcpPacket {
+// Source description with a CNAME item per source, RFC 3550 section 6.5.
+class SdesPacket : public RtcpPacket {
  public:
-  bool Parse(ByteReader* byte_reader);
-
-  std::vector<ReportBlock> GetReportBlocks() const;
-
- protected:
-  std::vector<ReportBlock> report_blocks_;
-  uint32_t sender_ssrc_{0};
-};
-
-// RFC 4585, Section 6.1: Feedback format.
-//
-// Common packet format:
-//
-//    0                   1                   2                   3
-//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-//   |V=2|P|   FMT   |       PT      |          length               |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-// 0 |                  SSRC of packet sender                        |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-// 4 |                  SSRC of media source                         |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-//   :            Feedback Control Information (FCI)                 :
-//   :                                                               :
-class RtpfbPacket : public RtcpPacket {
- public:
-  bool Parse(ByteReader* byte_reader) override;
-  uint32_t GetMediaSsrc();
-
- protected:
-  static constexpr size_t kCommonFeedbackLength = 8;
-  bool ParseCommonPeedback(ByteReader* byte_reader);
-  uint32_t sender_ssrc_{0};
-  uint32_t media_ssrc_{0};
-};
-
-// RFC 4585: Feedback format.
-//
-// Common packet format:
-//
-//    0                   1                   2                   3
-//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-//   |V=2|P|   FMT   |       PT      |          length               |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-// 0 |                  SSRC of packet sender                        |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-// 4 |                  SSRC of media source                         |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-//   :            Feedback Control Information (FCI)                 :
-//   :                                                               :
-//
-// Generic NACK (RFC 4585).
-//
-// FCI:
-//    0                   1                   2                   3
-//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-//   |            PID                |             BLP               |
-//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-class NackPacket : public RtpfbPacket {
- public:
-  bool Parse(ByteReader* byte_reader) override;
-  std::vector<uint16_t> GetLostPacketSequenceNumbers();
-
- private:
-  static constexpr size_t kNackItemLength = 4;
-  std::vector<uint16_t> packet_lost_sequence_numbers_;
-};
+  bool Serialize(ByteWriter* byte_writer);
 
-class RtcpCompound {
- public:
-  ~RtcpCompound();
-  bool Parse(uint8_t* data, int size);
-  std::vector<RtcpPacket*> GetRtcpPackets();
+  void AddCname(uint32_t ssrc, const std::string& cname);
 
  private:
-  std::vector<RtcpPacket*> rtcps_;
+  static constexpr uint8_t kCnameItem = 1;
+  static constexpr size_t kMaxChunks = 31;
+  std::vector<std::pair<uint32_t, std::string>> chunks_;
 };
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include "rtcp_parser.h"
+
+#include <algorithm>
+
+bool RtcpTransportFeedbackView::GetPacketResults(
+    std::vector<PacketResult>* results) const {
+  if (results)
+    results->clear();
+  if (size_ < kFixedFciLength)
+    return false;
+  uint16_t sequence_number = LoadUInt16BE(fci_);
+  size_t left = LoadUInt16BE(fci_ + 2);
+  uint32_t reference_time = LoadUInt24BE(fci_ + 4);
+
+  // The receive deltas follow the chunk holding the last status.
+  size_t delta_offset = kFixedFciLength;
+  for (size_t covered = 0; covered < left; delta_offset += 2) {
+    if (delta_offset + 2 > size_)
+      return false;
+    uint16_t chunk = LoadUInt16BE(fci_ + delta_offset);
+    if (!(chunk & 0x8000))
+      covered += chunk & 0x1fff;
+    else if (!(chunk & 0x4000))
+      covered += 14;
+    else
+      covered += 7;
+  }
+
+  // The reference time is a signed 24 bit value.
+  int64_t signed_reference_time = reference_time;
+  if (reference_time & 0x800000)
+    signed_reference_time -= 0x1000000;
+  int64_t arrival_time_us = signed_reference_time * kReferenceTimeUnitUs;
+  auto add_result = [&](uint8_t symbol) {
+    PacketResult result{sequence_number++, false, 0};
+    --left;
+    if (symbol == kSmallDelta) {
+      if (delta_offset + 1 > size_)
+        return false;
+      arrival_time_us += fci_[delta_offset] * kDeltaUnitUs;
+      delta_offset += 1;
+    } else if (symbol == kLargeDelta) {
+      if (delta_offset + 2 > size_)
+        return false;
+      arrival_time_us +=
+          static_cast<int16_t>(LoadUInt16BE(fci_ + delta_offset)) *
+          kDeltaUnitUs;
+      delta_offset += 2;
+    } else if (symbol != kNotReceived) {
+      return false;
+    }
+    if (symbol != kNotReceived) {
+      result.received = true;
+      result.arrival_time_us = arrival_time_us;
+    }
+    if (results)
+      results->push_back(result);
+    return true;
+  };
+
+  // The chunks were bounds checked above.
+  for (size_t offset = kFixedFciLength; left > 0; offset += 2) {
+    uint16_t chunk = LoadUInt16BE(fci_ + offset);
+    if (!(chunk & 0x8000)) {
+      // Run length chunk.
+      uint8_t symbol = (chunk >> 13) & 0x03;
+      size_t run_length = std::min<size_t>(chunk & 0x1fff, left);
+      for (size_t i = 0; i < run_length; ++i) {
+        if (!add_result(symbol))
+          return false;
+      }
+    } else if (!(chunk & 0x4000)) {
+      // Status vector chunk of 14 one bit symbols.
+      for (int shift = 13; shift >= 0 && left > 0; --shift) {
+        if (!add_result((chunk >> shift) & 0x01))
+          return false;
+      }
+    } else {
+      // Status vector chunk of 7 two bit symbols.
+      for (int shift = 12; shift >= 0 && left > 0; shift -= 2) {
+        if (!add_result((chunk >> shift) & 0x03))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool RtcpParser::Parse(const uint8_t* data, size_t size, Visitor* visitor) {
+  while (size > 0) {
+    if (size < kHeaderLength)
+      return false;
+    if ((data[0] >> 6) != kRtcpExpectedVersion)
+      return false;
+    bool padding = data[0] & 0x20;
+    uint8_t count_or_format = data[0] & 0x1f;
+    uint8_t packet_type = data[1];
+    size_t length = (LoadUInt16BE(data + 2) + 1) * 4;
+    if (length > size)
+      return false;
+
+    const uint8_t* payload = data + kHeaderLength;
+    size_t payload_size = length - kHeaderLength;
+    if (padding) {
+      if (payload_size == 0)
+        return false;
+      uint8_t padding_size = data[length - 1];
+      if (padding_size == 0 || padding_size > payload_size)
+        return false;
+      payload_size -= padding_size;
+    }
+
+    bool ok = true;
+    switch (packet_type) {
+      case kRtcpTypeSr:
+        ok = payload_size >= 4 + kSenderInfoLength &&
+             ParseReportBlocks(payload + 4 + kSenderInfoLength,
+                               payload_size - 4 - kSenderInfoLength,
+                               count_or_format, visitor);
+        break;
+      case kRtcpTypeRr:
+        ok = payload_size >= 4 &&
+             ParseReportBlocks(payload + 4, payload_size - 4, count_or_format,
+                               visitor);
+        break;
+      case kRtcpTypeRtpfb:
+        ok = ParseRtpfb(count_or_format, payload, payload_size, visitor);
+        break;
+      case kRtcpTypePsfb:
+        ok = ParsePsfb(count_or_format, payload, payload_size, visitor);
+        break;
+      default:
+        break;
+    }
+    if (!ok)
+      return false;
+    data += length;
+    size -= length;
+  }
+  return true;
+}
+
+bool RtcpParser::ParseReportBlocks(const uint8_t* data,
+                                   size_t size,
+                                   size_t count,
+                                   Visitor* visitor) {
+  if (size < count * ReportBlock::kLength)
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* block_data = data + i * ReportBlock::kLength;
+    ReportBlock block;
+    block.source_ssrc = LoadUInt32BE(block_data);
+    block.fraction_lost = block_data[4];
+    block.cumulative_lost = LoadUInt24BE(block_data + 5);
+    block.extended_high_seq_num = LoadUInt32BE(block_data + 8);
+    block.jitter = LoadUInt32BE(block_data + 12);
+    block.last_sr = LoadUInt32BE(block_data + 16);
+    block.delay_since_last_sr = LoadUInt32BE(block_data + 20);
+    visitor->OnReportBlock(block);
+  }
+  return true;
+}
+
+bool RtcpParser::ParseRtpfb(uint8_t format,
+                            const uint8_t* data,
+                            size_t size,
+                            Visitor* visitor) {
+  if (size < kCommonFeedbackLength)
+    return false;
+  uint32_t media_ssrc = LoadUInt32BE(data + 4);
+  const uint8_t* fci = data + kCommonFeedbackLength;
+  size_t fci_size = size - kCommonFeedbackLength;
+  if (format == 1) {
+    visitor->OnNack(RtcpNackView(media_ssrc, fci,
+                                 fci_size / RtcpNackView::kItemLength));
+  } else if (format == 15) {
+    RtcpTransportFeedbackView feedback(fci, fci_size);
+    if (!feedback.GetPacketResults(nullptr))
+      return false;
+    visitor->OnTransportFeedback(feedback);
+  }
+  return true;
+}
+
+bool RtcpParser::ParsePsfb(uint8_t format,
+                           const uint8_t* data,
+                           size_t size,
+                           Visitor* visitor) {
+  if (size < kCommonFeedbackLength)
+    return false;
+  uint32_t media_ssrc = LoadUInt32BE(data + 4);
+  const uint8_t* fci = data + kCommonFeedbackLength;
+  size_t fci_size = size - kCommonFeedbackLength;
+  if (format == 1) {
+    visitor->OnPli(media_ssrc);
+  } else if (format == 4) {
+    // RFC 5104 section 4.3.1, the SSRC, a sequence number and reserved
+    // bytes per request. A repeated request is still a request.
+    for (size_t offset = 0; offset + kFirItemLength <= fci_size;
+         offset += kFirItemLength)
+      visitor->OnFir(LoadUInt32BE(fci + offset));
+  } else if (format == 15 && fci_size >= 4 &&
+             LoadUInt32BE(fci) == 0x52454d42) {
+    // REMB, draft-alvestrand-rmcat-remb-03.
+    //  0                   1                   2                   3
+    //  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    // |  Unique identifier 'R' 'E' 'M' 'B'                            |
+    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    // |  Num SSRC     | BR Exp    |  BR Mantissa                      |
+    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    // |   SSRC feedback                                               |
+    // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+    if (fci_size < 8 || fci_size < 8 + fci[4] * 4u)
+      return false;
+    uint8_t exponent = fci[5] >> 2;
+    uint64_t mantissa = LoadUInt24BE(fci + 5) & 0x3ffff;
+    // The 18 bit mantissa shifted by more does not fit.
+    if (exponent > 64 - 18)
+      return false;
+    visitor->OnRemb(mantissa << exponent);
+  }
+  return true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "byte_buffer.h"
+#include "rtcp_packet.h"
+
+// Generic NACK (RFC 4585) over the FCI of a RTPFB format 1 packet.
+//
+// FCI:
+//    0                   1                   2                   3
+//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |            PID                |             BLP               |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+class RtcpNackView {
+ public:
+  static constexpr size_t kItemLength = 4;
+
+  RtcpNackView(uint32_t media_ssrc, const uint8_t* items, size_t count)
+      : media_ssrc_{media_ssrc}, items_{items}, count_{count} {}
+
+  uint32_t GetMediaSsrc() const {
+    return media_ssrc_;
+  }
+
+  // Calls |callback| with every lost sequence number, in packet order.
+  template <typename Callback>
+  void ForEachLostPacket(Callback callback) const {
+    for (size_t i = 0; i < count_; ++i) {
+      uint16_t pid = LoadUInt16BE(items_ + i * kItemLength);
+      uint16_t blp = LoadUInt16BE(items_ + i * kItemLength + 2);
+      callback(pid);
+      ++pid;
+      for (uint16_t bitmask = blp; bitmask != 0; bitmask >>= 1, ++pid) {
+        if (bitmask & 1)
+          callback(pid);
+      }
+    }
+  }
+
+ private:
+  uint32_t media_ssrc_;
+  const uint8_t* items_;
+  size_t count_;
+};
+
+// Transport-wide feedback, draft-holmer-rmcat-transport-wide-cc-extensions-01.
+//
+// FCI:
+//    0                   1                   2                   3
+//    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |      base sequence number     |      packet status count      |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |                 reference time                | fb pkt. count |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |          packet chunk         |         packet chunk          |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   .                                                               .
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |         packet chunk          |  recv delta   |  recv delta   |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   .                                                               .
+class RtcpTransportFeedbackView {
+ public:
+  static constexpr size_t kFixedFciLength = 8;
+
+  struct PacketResult {
+    uint16_t sequence_number;
+    bool received;
+    // On the clock of the receiver, only valid if |received|.
+    int64_t arrival_time_us;
+  };
+
+  // |fci| holds at least kFixedFciLength bytes.
+  RtcpTransportFeedbackView(const uint8_t* fci, size_t size)
+      : fci_{fci}, size_{size} {}
+
+  /**
+   * @brief Decode the packet statuses and receive deltas.
+   *
+   * @param results Cleared and filled, may be null to only validate. Keeping
+   * the vector around makes this allocation free.
+   * @return false if the FCI is malformed.
+   */
+  bool GetPacketResults(std::vector<PacketResult>* results) const;
+
+ private:
+  enum { kNotReceived = 0, kSmallDelta = 1, kLargeDelta = 2 };
+  static constexpr int64_t kReferenceTimeUnitUs = 64000;
+  static constexpr int64_t kDeltaUnitUs = 250;
+
+  const uint8_t* fci_;
+  size_t size_;
+};
+
+/**
+ * @brief Walks a compound RTCP packet in place, without allocating.
+ *
+ * Every known feedback message is handed to the visitor as it is reached,
+ * views point into the buffer and are only valid during the call.
+ */
+class RtcpParser {
+ public:
+  class Visitor {
+   public:
+    virtual ~Visitor() = default;
+
+    // The blocks of receiver and sender reports.
+    virtual void OnReportBlock(const ReportBlock& /*report_block*/) {}
+    virtual void OnNack(const RtcpNackView& /*nack*/) {}
+    virtual void OnPli(uint32_t /*media_ssrc*/) {}
+    // Once per FCI entry.
+    virtual void OnFir(uint32_t /*media_ssrc*/) {}
+    virtual void OnRemb(uint64_t /*bitrate*/) {}
+    virtual void OnTransportFeedback(
+        const RtcpTransportFeedbackView& /*feedback*/) {}
+  };
+
+  /**
+   * @return false if the compound packet is malformed, sub-packets before
+   * the malformed one have been visited.
+   */
+  static bool Parse(const uint8_t* data, size_t size, Visitor* visitor);
+
+ private:
+  static constexpr size_t kHeaderLength = 4;
+  static constexpr size_t kCommonFeedbackLength = 8;
+  static constexpr size_t kSenderInfoLength = 20;
+  static constexpr size_t kFirItemLength = 8;
+
+  static bool ParseReportBlocks(const uint8_t* data,
+                                size_t size,
+                                size_t count,
+                                Visitor* visitor);
+  static bool ParseRtpfb(uint8_t format,
+                         const uint8_t* data,
+                         size_t size,
+                         Visitor* visitor);
+  static bool ParsePsfb(uint8_t format,
+                        const uint8_t* data,
+                        size_t size,
+                        Visitor* visitor);
+};
@@ -64,18 +64,23 @@ H264RtpPacketizer::H264RtpPacketizer(uint32_t ssrc,
     : RtpPacketizer{ssrc, payload_type, clock_rate, listener} {}
 
 void H264RtpPacketizer::Pack(MediaPacket::Pointer packet) {
-  std::vector<NaluePosition> nalus;
   uint32_t timestamp = (double)packet->TimestampMillis() / 1000 * clock_rate_;
-  nalus = ParseNaluPositions(packet->Data(), packet->Size());
+  // The source normally parsed the frame already.
+  std::vector<H264Nalu> parsed_nalus;
+  if (packet->Nalus().empty())
+    parsed_nalus = ParseH264Nalus(packet->Data(), packet->Size());
+  const std::vector<H264Nalu>& nalus =
+      packet->Nalus().empty() ? parsed_nalus : packet->Nalus();
 
   frame_end_marker_ = 0;
   for (int i = 0; i < nalus.size(); ++i) {
     if (nalus.size() - i == 1)
       frame_end_marker_ = 1;
-    if (nalus[i].second <= kMaxRtpPayloadSize) {
-      PackSingNalu(nalus[i].first, nalus[i].second, timestamp);
+    const uint8_t* data = packet->Data() + nalus[i].offset;
+    if (nalus[i].size <= kMaxRtpPayloadSize) {
+      PackSingNalu(data, nalus[i].size, timestamp);
     } else {
-      PackFuA(nalus[i].first, nalus[i].second, timestamp);
+      PackFuA(data, nalus[i].size, timestamp);
     }
   }
 }
@@ -84,7 +89,8 @@ void H264RtpPacketizer::PackStapA(std::vector<std::string> nalus,
                                   int64_t timestamp) {
   if (nalus.empty())
     return;
-  uint8_t* p = rtp_buf_;
+  auto buffer = PacketBufferPool::GetInstance().Acquire();
+  uint8_t* p = buffer->Data();
   FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)p;
   rtp_hdr->SetPayloadType(payload_type_);
   rtp_hdr->SetSSrc(ssrc_);
@@ -112,8 +118,9 @@ void H264RtpPacketizer::PackStapA(std::vector<std::string> nalus,
   }
 
   if (listener_) {
-    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize, rtp_buf_,
-                  p - rtp_buf_);
+    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize,
+                  buffer->Data(), p - buffer->Data());
+    pkt.SetBuffer(std::move(buffer));
     listener_->OnRtpPacketGenerated(&pkt);
   }
 }
@@ -121,8 +128,9 @@ void H264RtpPacketizer::PackStapA(std::vector<std::string> nalus,
 void H264RtpPacketizer::PackSingNalu(const uint8_t* data,
                                      int size,
                                      uint32_t timestamp) {
-  uint8_t* p = rtp_buf_;
-  FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)rtp_buf_;
+  auto buffer = PacketBufferPool::GetInstance().Acquire();
+  uint8_t* p = buffer->Data();
+  FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)buffer->Data();
   rtp_hdr->SetPayloadType(payload_type_);
   rtp_hdr->SetSSrc(ssrc_);
   rtp_hdr->SetTimestamp(timestamp);
@@ -136,8 +144,9 @@ void H264RtpPacketizer::PackSingNalu(const uint8_t* data,
   memcpy(p, data, size);
   p += size;
   if (listener_) {
-    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize, rtp_buf_,
-                  p - rtp_buf_);
+    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize,
+                  buffer->Data(), p - buffer->Data());
+    pkt.SetBuffer(std::move(buffer));
     listener_->OnRtpPacketGenerated(&pkt);
   }
 }
@@ -155,7 +164,8 @@ void H264RtpPacketizer::PackFuA(const uint8_t* data, int size, uint32_t timestam
   while (!end) {
     if (size <= kMaxRtpPayloadSize - 2)
       end = true;
-    uint8_t* p = rtp_buf_;
+    auto buffer = PacketBufferPool::GetInstance().Acquire();
+    uint8_t* p = buffer->Data();
     FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)p;
     rtp_hdr->SetPayloadType(payload_type_);
     rtp_hdr->SetSSrc(ssrc_);
@@ -188,7 +198,8 @@ void H264RtpPacketizer::PackFuA(const uint8_t* data, int size, uint32_t timestam
     p += data_len;
     if (listener_) {
       RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize,
-                    rtp_buf_, p - rtp_buf_);
+                    buffer->Data(), p - buffer->Data());
+      pkt.SetBuffer(std::move(buffer));
       listener_->OnRtpPacketGenerated(&pkt);
     }
 
@@ -198,45 +209,6 @@ void H264RtpPacketizer::PackFuA(const uint8_t* data, int size, uint32_t timestam
   assert(size == 0);
 }
 
-std::vector<H264RtpPacketizer::NaluePosition> H264RtpPacketizer::ParseNaluPositions(const uint8_t* buffer, size_t buffer_size) {
-  std::vector<NaluePosition> sequences;
-  if (buffer_size < 3)
-    return sequences;
-
-  const size_t end = buffer_size - 3;
-  for (size_t i = 0; i < end;) {
-    if (buffer[i + 2] > 1) {
-      i += 3;
-    } else if (buffer[i + 2] == 1) {
-      if (buffer[i + 1] == 0 && buffer[i] == 0) {
-        // We found a start sequence, now check if it was a 3 of 4 byte one.
-        NaluePosition index = std::make_pair<NaluStart, NaluLength>(buffer + i + 3, 0);
-        size_t start_offset = i;
-        if (start_offset > 0 && buffer[start_offset - 1] == 0)
-          --start_offset;
-
-        // Update length of previous entry.
-        auto it = sequences.rbegin();
-        if (it != sequences.rend())
-          it->second = start_offset - (it->first - buffer);
-
-        sequences.push_back(index);
-      }
-
-      i += 3;
-    } else {
-      ++i;
-    }
-  }
-
-  // Update length of last entry, if any.
-  auto it = sequences.rbegin();
-  if (it != sequences.rend())
-    it->second = buffer_size - (it->first - buffer);
-
-  return sequences;
-}
-
 OpusRtpPacketizer::OpusRtpPacketizer(uint32_t ssrc,
                                      uint8_t payload_type,
                                      uint32_t clock_rate,
@@ -244,8 +216,10 @@ OpusRtpPacketizer::OpusRtpPacketizer(uint32_t ssrc,
     : RtpPacketizer{ssrc, payload_type, clock_rate, listener} {}
 
 void OpusRtpPacketizer::Pack(MediaPacket::Pointer packet) {
-  uint8_t* p = rtp_buf_;
-  FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)rtp_buf_;
+  auto buffer = PacketBufferPool::GetInstance().Acquire(kRtpHeaderFixedSize +
+                                                        packet->Size());
+  uint8_t* p = buffer->Data();
+  FixedRtpHeader* rtp_hdr = (FixedRtpHeader*)buffer->Data();
   uint32_t timestamp = (double)packet->TimestampMillis() / 1000 * clock_rate_;
 
   rtp_hdr->SetPayloadType(payload_type_);
@@ -261,8 +235,54 @@ void OpusRtpPacketizer::Pack(MediaPacket::Pointer packet) {
   memcpy(p, packet->Data(), packet->Size());
   p += packet->Size();
   if (listener_) {
-    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize, rtp_buf_,
-                  p - rtp_buf_);
+    RtpPacket pkt(ssrc_, seqnum_ - 1, timestamp, kRtpHeaderFixedSize,
+                  buffer->Data(), p - buffer->Data());
+    pkt.SetBuffer(std::move(buffer));
     listener_->OnRtpPacketGenerated(&pkt);
   }
+}
+
+RtpPacketGroup::RtpPacketGroup(size_t capacity) {
+  buffer_.reserve(capacity);
+}
+
+void RtpPacketGroup::Append(const RtpPacket& pkt) {
+  entries_.emplace_back(buffer_.size(), pkt.Size());
+  buffer_.insert(buffer_.end(), pkt.Data(), pkt.Data() + pkt.Size());
+  timestamp_ = pkt.GetTimestamp();
+}
+
+size_t RtpPacketGroup::Count() const {
+  return entries_.size();
+}
+
+const uint8_t* RtpPacketGroup::Data(size_t index) const {
+  return buffer_.data() + entries_[index].first;
+}
+
+uint32_t RtpPacketGroup::Size(size_t index) const {
+  return entries_[index].second;
+}
+
+uint32_t RtpPacketGroup::GetTimestamp() const {
+  return timestamp_;
+}
+
+SharedRtpPacketizer::SharedRtpPacketizer()
+    : h264_packetizer_{0, 0, 90000, this}, opus_packetizer_{0, 0, 48000, this} {}
+
+void SharedRtpPacketizer::Pack(MediaPacket::Pointer packet) {
+  // Leave room for the headers of the FU-A fragments.
+  size_t fragments = packet->Size() / (kMaxRtpPayloadSize - 2) + 1;
+  group_ = std::make_shared<RtpPacketGroup>(
+      packet->Size() + fragments * (kRtpHeaderFixedSize + 2));
+  if (packet->PacketType() == MediaPacket::Type::kVideo)
+    h264_packetizer_.Pack(packet);
+  else
+    opus_packetizer_.Pack(packet);
+  packet->RtpPackets(std::move(group_));
+}
+
+void SharedRtpPacketizer::OnRtpPacketGenerated(RtpPacket* pkt) {
+  group_->Append(*pkt);
 }
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "media_packet.h"
+#include "packet_buffer.h"
 
 constexpr uint32_t kMaxRtpPayloadSize = 1200;
 constexpr uint32_t kRtpHeaderFixedSize = 12;
@@ -70,6 +73,18 @@ class RtpPacket {
     return timestamp_;
   }
 
+  // Rewrites the header too.
+  void SetSequenceNumber(uint16_t sequence_number) {
+    sequence_number_ = sequence_number;
+    reinterpret_cast<FixedRtpHeader*>(data_)->SetSeqNum(sequence_number);
+  }
+
+  // Rewrites the header too.
+  void SetTimestamp(uint32_t timestamp) {
+    timestamp_ = timestamp;
+    reinterpret_cast<FixedRtpHeader*>(data_)->SetTimestamp(timestamp);
+  }
+
   uint32_t GetHeaderOffset() const {
     return header_offset_;
   }
@@ -82,6 +97,17 @@ class RtpPacket {
     return data_;
   }
 
+  // Hand over the pooled buffer behind Data(), the packet then only views it.
+  void SetBuffer(PacketBuffer::Pointer buffer) {
+    buffer->SetSize(size_);
+    buffer_ = std::move(buffer);
+  }
+
+  // Null if the packet does not own its data.
+  PacketBuffer::Pointer ReleaseBuffer() {
+    return std::move(buffer_);
+  }
+
  private:
   uint32_t ssrc_;
   uint16_t sequence_number_;
@@ -89,6 +115,7 @@ class RtpPacket {
   uint32_t header_offset_;
   uint32_t size_;
   uint8_t* data_;
+  PacketBuffer::Pointer buffer_;
 };
 
 class RtpPacketizer {
@@ -105,13 +132,11 @@ class RtpPacketizer {
   virtual void Pack(MediaPacket::Pointer packet) = 0;
 
  protected:
-  static constexpr uint32_t kRtpBufferSize = 5000;
   uint16_t seqnum_{0};
   uint8_t payload_type_{0};
   uint32_t clock_rate_;
   uint32_t ssrc_{0};
   Observer* listener_{nullptr};
-  uint8_t rtp_buf_[kRtpBufferSize];
   bool have_twcc_extension_{false};
 };
 
@@ -124,10 +149,6 @@ class H264RtpPacketizer : public RtpPacketizer {
   void Pack(MediaPacket::Pointer packet) override;
 
  private:
-  using NaluStart = const uint8_t*;
-  using NaluLength = size_t;
-  using NaluePosition = std::pair<NaluStart, NaluLength>;
-  std::vector<NaluePosition> ParseNaluPositions(const uint8_t* buffer, size_t buffer_size);
   void PackSingNalu(const uint8_t* data, int size, uint32_t timestamp);
   void PackFuA(const uint8_t* data, int size, uint32_t timestamp);
   void PackStapA(std::vector<std::string> nalus, int64_t timestamp);
@@ -141,4 +162,51 @@ class OpusRtpPacketizer : public RtpPacketizer {
                     uint32_t clock_rate,
                     Observer* listener);
   void Pack(MediaPacket::Pointer packet) override;
+};
+
+/**
+ * @brief The RTP packets of one media packet, shared by all viewers.
+ *
+ * SSRC, sequence number and payload type are left zero, every viewer writes
+ * its own into a copy of the fixed header.
+ */
+class RtpPacketGroup {
+ public:
+  using Pointer = std::shared_ptr<const RtpPacketGroup>;
+
+  explicit RtpPacketGroup(size_t capacity);
+
+  void Append(const RtpPacket& pkt);
+
+  size_t Count() const;
+
+  const uint8_t* Data(size_t index) const;
+
+  uint32_t Size(size_t index) const;
+
+  uint32_t GetTimestamp() const;
+
+ private:
+  using Entry = std::pair<uint32_t, uint32_t>;  // Offset and size.
+  std::vector<uint8_t> buffer_;
+  std::vector<Entry> entries_;
+  uint32_t timestamp_{0};
+};
+
+/**
+ * @brief Packetizes the media packets of a source once for all viewers.
+ */
+class SharedRtpPacketizer : public RtpPacketizer::Observer {
+ public:
+  SharedRtpPacketizer();
+
+  // Attach the RTP packets of |packet| to it.
+  void Pack(MediaPacket::Pointer packet);
+
+ private:
+  void OnRtpPacketGenerated(RtpPacket* pkt) override;
+
+  H264RtpPacketizer h264_packetizer_;
+  OpusRtpPacketizer opus_packetizer_;
+  std::shared_ptr<RtpPacketGroup> group_;
 };
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "server_config.h"
 
+#include <algorithm>
+
 #include "toml.hpp"
 #include "spdlog/spdlog.h"
 
@@ -17,6 +19,35 @@ bool ServerConfig::Load(boost::string_view json_file_name) {
     webrtc_min_port_ = toml::find<uint16_t>(data, "webrtcMinPort");
     webrtc_max_port_ = toml::find<uint16_t>(data, "webrtcMaxPort");
     enable_gop_cache_ = toml::find<bool>(data, "enableGopCache");
+    enable_udp_mux_ = toml::find_or<bool>(data, "enableUdpMux", false);
+    udp_mux_port_ = toml::find_or<uint16_t>(data, "udpMuxPort", 9000);
+    udp_mux_socket_count_ =
+        toml::find_or<uint32_t>(data, "udpMuxSocketCount", 4);
+    udp_send_batch_size_ =
+        toml::find_or<uint32_t>(data, "udpSendBatchSize", 32);
+    enable_udp_gso_ = toml::find_or<bool>(data, "enableUdpGso", false);
+    udp_recv_batch_size_ =
+        toml::find_or<uint32_t>(data, "udpRecvBatchSize", 32);
+    worker_threads_ = toml::find_or<uint32_t>(data, "workerThreads", 0);
+    enable_shared_packetization_ =
+        toml::find_or<bool>(data, "enableSharedPacketization", false);
+    // A queue without room would drop every packet.
+    viewer_queue_size_ = std::max<uint32_t>(
+        toml::find_or<uint32_t>(data, "viewerQueueSize", 512), 1);
+    video_nack_history_size_ =
+        toml::find_or<uint32_t>(data, "videoNackHistorySize", 1024);
+    audio_nack_history_size_ =
+        toml::find_or<uint32_t>(data, "audioNackHistorySize", 128);
+    enable_twcc_ = toml::find_or<bool>(data, "enableTwcc", true);
+    pacing_factor_ = toml::find_or<double>(data, "pacingFactor", 2.5);
+    egress_rate_limit_kbps_ =
+        toml::find_or<uint32_t>(data, "egressRateLimitKbps", 0);
+    enable_temporal_thinning_ =
+        toml::find_or<bool>(data, "enableTemporalThinning", true);
+    enable_ulpfec_ = toml::find_or<bool>(data, "enableUlpfec", false);
+    enable_opus_red_ = toml::find_or<bool>(data, "enableOpusRed", true);
+    resend_budget_ratio_ =
+        toml::find_or<double>(data, "resendBudgetRatio", 0.5);
   } catch (...) {
     spdlog::error("Parse config file failed.");
     return false;
@@ -48,3 +79,75 @@ uint16_t ServerConfig::GetWebRtcMinPort() const {
 bool ServerConfig::GetEnableGopCache() const {
   return enable_gop_cache_;
 }
+
+bool ServerConfig::GetEnableUdpMux() const {
+  return enable_udp_mux_;
+}
+
+uint16_t ServerConfig::GetUdpMuxPort() const {
+  return udp_mux_port_;
+}
+
+uint32_t ServerConfig::GetUdpMuxSocketCount() const {
+  return udp_mux_socket_count_;
+}
+
+uint32_t ServerConfig::GetUdpSendBatchSize() const {
+  return udp_send_batch_size_;
+}
+
+bool ServerConfig::GetEnableUdpGso() const {
+  return enable_udp_gso_;
+}
+
+uint32_t ServerConfig::GetUdpRecvBatchSize() const {
+  return udp_recv_batch_size_;
+}
+
+uint32_t ServerConfig::GetWorkerThreads() const {
+  return worker_threads_;
+}
+
+bool ServerConfig::GetEnableSharedPacketization() const {
+  return enable_shared_packetization_;
+}
+
+uint32_t ServerConfig::GetViewerQueueSize() const {
+  return viewer_queue_size_;
+}
+
+uint32_t ServerConfig::GetVideoNackHistorySize() const {
+  return video_nack_history_size_;
+}
+
+uint32_t ServerConfig::GetAudioNackHistorySize() const {
+  return audio_nack_history_size_;
+}
+
+bool ServerConfig::GetEnableTwcc() const {
+  return enable_twcc_;
+}
+
+double ServerConfig::GetPacingFactor() const {
+  return pacing_factor_;
+}
+
+uint32_t ServerConfig::GetEgressRateLimitKbps() const {
+  return egress_rate_limit_kbps_;
+}
+
+bool ServerConfig::GetEnableTemporalThinning() const {
+  return enable_temporal_thinning_;
+}
+
+bool ServerConfig::GetEnableUlpfec() const {
+  return enable_ulpfec_;
+}
+
+bool ServerConfig::GetEnableOpusRed() const {
+  return enable_opus_red_;
+}
+
+double ServerConfig::GetResendBudgetRatio() const {
+  return resend_budget_ratio_;
+}
@@ -14,6 +14,24 @@ class ServerConfig {
   uint16_t GetWebRtcMaxPort() const;
   uint16_t GetWebRtcMinPort() const;
   bool GetEnableGopCache() const;
+  bool GetEnableUdpMux() const;
+  uint16_t GetUdpMuxPort() const;
+  uint32_t GetUdpMuxSocketCount() const;
+  uint32_t GetUdpSendBatchSize() const;
+  bool GetEnableUdpGso() const;
+  uint32_t GetUdpRecvBatchSize() const;
+  uint32_t GetWorkerThreads() const;
+  bool GetEnableSharedPacketization() const;
+  uint32_t GetViewerQueueSize() const;
+  uint32_t GetVideoNackHistorySize() const;
+  uint32_t GetAudioNackHistorySize() const;
+  bool GetEnableTwcc() const;
+  double GetPacingFactor() const;
+  uint32_t GetEgressRateLimitKbps() const;
+  bool GetEnableTemporalThinning() const;
+  bool GetEnableUlpfec() const;
+  bool GetEnableOpusRed() const;
+  double GetResendBudgetRatio() const;
 
  private:
   ServerConfig() = default;
@@ -23,4 +41,22 @@ class ServerConfig {
   uint16_t webrtc_max_port_;
   uint16_t webrtc_min_port_;
   bool enable_gop_cache_;
+  bool enable_udp_mux_;
+  uint16_t udp_mux_port_;
+  uint32_t udp_mux_socket_count_;
+  uint32_t udp_send_batch_size_;
+  bool enable_udp_gso_;
+  uint32_t udp_recv_batch_size_;
+  uint32_t worker_threads_;
+  bool enable_shared_packetization_;
+  uint32_t viewer_queue_size_;
+  uint32_t video_nack_history_size_;
+  uint32_t audio_nack_history_size_;
+  bool enable_twcc_;
+  double pacing_factor_;
+  uint32_t egress_rate_limit_kbps_;
+  bool enable_temporal_thinning_;
+  bool enable_ulpfec_;
+  bool enable_opus_red_;
+  double resend_budget_ratio_;
 };
\ No newline at end of file
@@ -1,13 +1,44 @@
 #include "signaling_session.h"
 
 #include "media_source_manager.h"
+#include "metrics.h"
 #include "nlohmann/json.hpp"
 #include "spdlog/spdlog.h"
 #include "webrtc_transport.h"
 #include "webrtc_transport_manager.h"
 
+static nlohmann::json TrackStatsToJson(const StreamTrack::Stats& stats) {
+  nlohmann::json json;
+  json["rttMillis"] = stats.rtt_millis;
+  json["fractionLost"] = stats.fraction_lost / 256.0;
+  json["cumulativeLost"] = stats.cumulative_lost;
+  json["jitterMillis"] = stats.jitter_millis;
+  json["nackPackets"] = stats.nack_packets;
+  json["nackedPackets"] = stats.nacked_packets;
+  json["resentPackets"] = stats.resent_packets;
+  json["resentBytes"] = stats.resent_bytes;
+  return json;
+}
+
+static nlohmann::json ViewerStatsToJson(const WebrtcTransport::Stats& stats) {
+  nlohmann::json json;
+  json["id"] = stats.id;
+  json["video"] = TrackStatsToJson(stats.video);
+  json["audio"] = TrackStatsToJson(stats.audio);
+  json["egressBitrate"] = stats.egress_bitrate;
+  json["targetBitrate"] = stats.target_bitrate;
+  json["queuedPackets"] = stats.pacer.queued_packets;
+  json["queuedBytes"] = stats.pacer.queued_bytes;
+  json["queueDelayMillis"] = stats.pacer.queue_delay_millis;
+  json["droppedVideoPackets"] = stats.delivery.dropped_video_packets;
+  json["droppedAudioPackets"] = stats.delivery.dropped_audio_packets;
+  return json;
+}
+
 void SignalingSession::HandleRequest() {
   nlohmann::json response_json;
+  // Sent instead of |response_json| when set.
+  std::string metrics;
 
   if (request_.target() == "/play") {
     if (request_.method() == http::verb::post) {
@@ -19,7 +50,6 @@ void SignalingSession::HandleRequest() {
         auto webrtc_transport =
             std::make_shared<WebrtcTransport>(json["streamId"]);
         if (webrtc_transport->SetOffer(json["offer"]) && webrtc_transport->Start()) {
-          media_source->RegisterObserver(webrtc_transport.get());
           auto sdp = webrtc_transport->CreateAnswer();
           WebrtcTransportManager::GetInstance().Add(webrtc_transport);
           response_json["error"] = false;
@@ -31,6 +61,30 @@ void SignalingSession::HandleRequest() {
         response_json["error"] = true;
       }
     }
+  } else if (request_.target() == "/metrics") {
+    if (request_.method() == http::verb::get)
+      metrics = Metrics::GetInstance().Export();
+    else
+      response_json["error"] = true;
+  } else if (request_.target().starts_with("/streams/") &&
+             request_.target().ends_with("/viewers")) {
+    if (request_.method() == http::verb::get) {
+      auto target = request_.target();
+      auto id = target.substr(strlen("/streams/"),
+                              target.size() - strlen("/streams/") -
+                                  strlen("/viewers"));
+      if (!MediaSourceManager::GetInstance().Query({id.data(), id.size()})) {
+        response_json["error"] = true;
+      } else {
+        response_json = nlohmann::json::array();
+        auto viewers = WebrtcTransportManager::GetInstance().QueryStats(
+            {id.data(), id.size()});
+        for (auto& viewer : viewers)
+          response_json.push_back(ViewerStatsToJson(viewer));
+      }
+    } else {
+      response_json["error"] = true;
+    }
   } else if (request_.target().starts_with("/streams")) {
     if (request_.method() == http::verb::get)
       response_json = MediaSourceManager::GetInstance().List();
@@ -62,10 +116,11 @@ void SignalingSession::HandleRequest() {
   }
 
   response_.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-  response_.set(http::field::content_type, "text/plain");
+  response_.set(http::field::content_type,
+                metrics.empty() ? "text/plain" : "text/plain; version=0.0.4");
   response_.set(http::field::access_control_allow_origin, "*");
   response_.keep_alive(request_.keep_alive());
-  response_.body() = response_json.dump();
+  response_.body() = metrics.empty() ? response_json.dump() : metrics;
 
   http::async_write(
     stream_, response_,
@@ -1,5 +1,7 @@
 #include "srtp_session.h"
 
+#include "metrics.h"
+
 std::map<std::string, SrtpSession::CipherSuite>
     SrtpSession::str_to_cipher_suite_ = {
         {"SRTP_AES128_CM_SHA1_80", CipherSuite::SUITE_AES_CM_128_HMAC_SHA1_80},
@@ -123,6 +125,7 @@ bool SrtpSession::ProtectRtp(void* data,
   int err = srtp_protect(session_, data, out_len);
   if (err != srtp_err_status_ok) {
     spdlog::warn("Failed to protect rtp packet. err = {}", err);
+    Metrics::GetInstance().srtp_protect_failures.Add(1);
     return false;
   }
   return true;
@@ -150,6 +153,7 @@ bool SrtpSession::ProtectRtcp(void* data,
   int err = srtp_protect_rtcp(session_, data, out_len);
   if (err != srtp_err_status_ok) {
     spdlog::warn("Failed to protect rtcp packet.");
+    Metrics::GetInstance().srtp_protect_failures.Add(1);
     return false;
   }
   return true;
@@ -165,6 +169,7 @@ bool SrtpSession::UnprotectRtp(void* data, int in_len, int* out_len) {
   int err = srtp_unprotect(session_, data, out_len);
   if (err != srtp_err_status_ok) {
     spdlog::warn("Failed to unprotect rtp packet.");
+    Metrics::GetInstance().srtp_unprotect_failures.Add(1);
     return false;
   }
   return true;
@@ -180,6 +185,7 @@ bool SrtpSession::UnprotectRtcp(void* data, int in_len, int* out_len) {
   int err = srtp_unprotect_rtcp(session_, data, out_len);
   if (err != srtp_err_status_ok) {
     spdlog::warn("Failed to unprotect rtcp packet. err = {}", err);
+    Metrics::GetInstance().srtp_unprotect_failures.Add(1);
     return false;
   }
   return true;
@@ -121,6 +121,37 @@ bool StunMessage::IsStun(uint8_t* data, size_t size) {
          (LoadUInt32BE(data + 4) == kStunMagicCookie);
 }
 
+bool StunMessage::FindUsername(const uint8_t* data,
+                               size_t size,
+                               boost::string_view* username) {
+  ByteReader reader(data, size);
+  if (!reader.Consume(kStunHeaderSize))
+    return false;
+
+  while (reader.Left() > 0) {
+    uint16_t attr_type, attr_length;
+    if (!reader.ReadUInt16(&attr_type))
+      return false;
+    if (!reader.ReadUInt16(&attr_length))
+      return false;
+    if (reader.Left() < attr_length)
+      return false;
+    if (attr_type == Attribute::kAttrUsername) {
+      *username =
+          boost::string_view((const char*)reader.CurrentData(), attr_length);
+      return true;
+    }
+
+    if ((attr_length % 4) != 0) {
+      attr_length += (4 - (attr_length % 4));
+    }
+    if (!reader.Consume(attr_length)) {
+      return false;
+    }
+  }
+  return false;
+}
+
 bool StunMessage::HasUseCandidate() const {
   return has_use_candidate_;
 }
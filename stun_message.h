@@ -56,6 +56,11 @@ class StunMessage {
   bool HasUseCandidate() const;
 
   static bool IsStun(uint8_t* data, size_t size);
+  // Finds the USERNAME attribute without verifying the message, so that a
+  // request can be routed before it reaches its IceLite.
+  static bool FindUsername(const uint8_t* data,
+                           size_t size,
+                           boost::string_view* username);
 
  private:
   std::string transaction_id_;
@@ -0,0 +1,218 @@
+// Checks the start code finders against the scanner ParseH264Nalus had
+// before them. The translation unit is included to reach every variant, not
+// only the one the CPU dispatches to.
+#include "h264_parser.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+namespace {
+
+int failures = 0;
+
+void Check(bool condition, const std::string& what) {
+  if (!condition) {
+    ++failures;
+    std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+  }
+}
+
+struct Finder {
+  const char* name;
+  FindStartCodeFunction function;
+};
+
+std::vector<Finder> SupportedFinders() {
+  std::vector<Finder> finders{{"scalar", &FindStartCodeScalar},
+                              {"dispatched", &FindH264StartCode}};
+#ifdef H264_PARSER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    finders.push_back({"sse2", &FindStartCodeSse2});
+  if (__builtin_cpu_supports("avx2"))
+    finders.push_back({"avx2", &FindStartCodeAvx2});
+#endif
+  return finders;
+}
+
+const uint8_t* FindStartCodeReference(const uint8_t* begin,
+                                      const uint8_t* end) {
+  for (const uint8_t* p = begin; end - p >= 3; ++p) {
+    if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+      return p;
+  }
+  return end;
+}
+
+// ParseH264Nalus before the finders, without ref_idc.
+std::vector<H264Nalu> OldParseH264Nalus(const uint8_t* data, size_t size) {
+  std::vector<H264Nalu> nalus;
+  if (size < 3)
+    return nalus;
+
+  const size_t end = size - 3;
+  for (size_t i = 0; i < end;) {
+    if (data[i + 2] > 1) {
+      i += 3;
+    } else if (data[i + 2] == 1) {
+      if (data[i + 1] == 0 && data[i] == 0) {
+        size_t start_offset = i;
+        if (start_offset > 0 && data[start_offset - 1] == 0)
+          --start_offset;
+        if (!nalus.empty())
+          nalus.back().size = start_offset - nalus.back().offset;
+        nalus.push_back({static_cast<uint32_t>(i + 3), 0, 0, 0});
+      }
+      i += 3;
+    } else {
+      ++i;
+    }
+  }
+
+  if (!nalus.empty())
+    nalus.back().size = size - nalus.back().offset;
+  for (auto& nalu : nalus) {
+    if (nalu.size > 0)
+      nalu.type = data[nalu.offset] & kNaluTypeMask;
+  }
+  return nalus;
+}
+
+bool SameNalus(const std::vector<H264Nalu>& a,
+               const std::vector<H264Nalu>& b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].offset != b[i].offset || a[i].size != b[i].size ||
+        a[i].type != b[i].type)
+      return false;
+  }
+  return true;
+}
+
+std::string Describe(const Finder& finder, size_t size, size_t position) {
+  return std::string(finder.name) + " size " + std::to_string(size) +
+         " position " + std::to_string(position);
+}
+
+// One start code at every position of buffers up to a few SIMD blocks, so it
+// sits in the first, middle and last lane of a block, across two blocks and
+// in the scalar tail.
+void TestEveryPosition(const std::vector<Finder>& finders) {
+  for (size_t size = 0; size <= 100; ++size) {
+    for (size_t position = 0; position + 3 <= size; ++position) {
+      std::vector<uint8_t> buffer(size, 0xff);
+      buffer[position] = 0;
+      buffer[position + 1] = 0;
+      buffer[position + 2] = 1;
+      const uint8_t* begin = buffer.data();
+      const uint8_t* end = begin + size;
+      for (auto& finder : finders) {
+        Check(finder.function(begin, end) == begin + position,
+              Describe(finder, size, position));
+      }
+    }
+  }
+}
+
+// Start codes cut off by the end of the range are not reported.
+void TestTail(const std::vector<Finder>& finders) {
+  for (size_t size = 2; size <= 100; ++size) {
+    std::vector<uint8_t> buffer(size, 0xff);
+    buffer[size - 2] = 0;
+    buffer[size - 1] = 0;
+    for (auto& finder : finders) {
+      const uint8_t* begin = buffer.data();
+      Check(finder.function(begin, begin + size) == begin + size,
+            Describe(finder, size, size - 2) + " cut 00 00");
+    }
+
+    if (size < 3)
+      continue;
+    buffer.assign(size, 0xff);
+    buffer[size - 3] = 0;
+    buffer[size - 2] = 0;
+    buffer[size - 1] = 1;
+    for (auto& finder : finders) {
+      const uint8_t* begin = buffer.data();
+      Check(finder.function(begin, begin + size - 1) == begin + size - 1,
+            Describe(finder, size, size - 3) + " cut 00 00 01");
+      Check(finder.function(begin, begin + size) == begin + size - 3,
+            Describe(finder, size, size - 3) + " last 00 00 01");
+    }
+  }
+}
+
+// The finders report the 00 00 01 of a 00 00 00 01, the parser strips the
+// leading zero from the previous NAL unit.
+void TestFourByteStartCode(const std::vector<Finder>& finders) {
+  for (size_t position = 0; position < 70; ++position) {
+    std::vector<uint8_t> frame(position, 0xff);
+    const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xff};
+    const uint8_t idr[] = {0, 0, 0, 1, 0x65, 0x88, 0xff, 0xff};
+    frame.insert(frame.end(), sps, sps + sizeof(sps));
+    frame.insert(frame.end(), idr, idr + sizeof(idr));
+    const uint8_t* begin = frame.data();
+    const uint8_t* end = begin + frame.size();
+    for (auto& finder : finders) {
+      Check(finder.function(begin, end) == begin + position + 1,
+            Describe(finder, frame.size(), position) + " 00 00 00 01");
+    }
+
+    auto nalus = ParseH264Nalus(frame.data(), frame.size());
+    Check(nalus.size() == 2 && nalus[0].type == kH264NaluSps &&
+              nalus[0].size == 3 && nalus[1].type == kH264NaluIdr &&
+              nalus[1].ref_idc == 3,
+          "parse 00 00 00 01 at " + std::to_string(position));
+    Check(SameNalus(nalus, OldParseH264Nalus(frame.data(), frame.size())),
+          "old parser 00 00 00 01 at " + std::to_string(position));
+  }
+}
+
+// Mostly 0 and 1 bytes, so start codes and near misses are everywhere.
+void TestRandom(const std::vector<Finder>& finders) {
+  std::mt19937 random(20240611);
+  std::uniform_int_distribution<int> byte(0, 7);
+  std::uniform_int_distribution<size_t> length(0, 300);
+  for (int round = 0; round < 20000; ++round) {
+    std::vector<uint8_t> buffer(length(random));
+    for (auto& value : buffer) {
+      int draw = byte(random);
+      value = draw < 3 ? 0 : draw < 5 ? 1 : static_cast<uint8_t>(draw * 37);
+    }
+    const uint8_t* begin = buffer.data();
+    const uint8_t* end = begin + buffer.size();
+    for (const uint8_t* p = begin; p <= end; p += 5) {
+      const uint8_t* expected = FindStartCodeReference(p, end);
+      for (auto& finder : finders) {
+        Check(finder.function(p, end) == expected,
+              Describe(finder, buffer.size(), p - begin) + " random");
+      }
+    }
+    Check(SameNalus(ParseH264Nalus(begin, buffer.size()),
+                    OldParseH264Nalus(begin, buffer.size())),
+          "old parser random round " + std::to_string(round));
+  }
+}
+
+}  // namespace
+
+int main() {
+  auto finders = SupportedFinders();
+  for (auto& finder : finders)
+    std::printf("Testing %s\n", finder.name);
+
+  TestEveryPosition(finders);
+  TestTail(finders);
+  TestFourByteStartCode(finders);
+  TestRandom(finders);
+
+  if (failures > 0) {
+    std::fprintf(stderr, "%d checks failed.\n", failures);
+    return EXIT_FAILURE;
+  }
+  std::printf("All checks passed.\n");
+  return EXIT_SUCCESS;
+}
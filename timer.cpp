@@ -1,7 +1,5 @@
 #include "timer.h"
 
-#include <boost/bind/bind.hpp>
-
 Timer::Timer(boost::asio::io_context& io_context, Listener* listener)
     : io_context_{io_context},
       timer_{std::make_unique<boost::asio::deadline_timer>(io_context_)},
@@ -13,8 +11,11 @@ Timer::~Timer() {
 
 void Timer::AsyncWait(uint64_t timeout) {
   timer_->expires_from_now(boost::posix_time::milliseconds(timeout));
-  timer_->async_wait(
-      boost::bind(&Timer::OnTimeout, this, boost::asio::placeholders::error));
+  std::weak_ptr<bool> alive = alive_;
+  timer_->async_wait([this, alive](const boost::system::error_code& ec) {
+    if (!alive.expired())
+      OnTimeout(ec);
+  });
 }
 
 void Timer::OnTimeout(const boost::system::error_code& ec) {
@@ -25,4 +25,7 @@ class Timer {
   boost::asio::io_context& io_context_;
   std::unique_ptr<boost::asio::deadline_timer> timer_;
   Listener* listener_;
+  // Expires with the timer, a completion that is already queued when the
+  // timer is destroyed checks it before touching |this|.
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
 };
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "udp_mux.h"
+
+#include <cstring>
+
+#include "server_config.h"
+#include "spdlog/spdlog.h"
+#include "stun_message.h"
+
+UdpMux::Worker::Worker(UdpMux* mux) : mux_{mux} {}
+
+void UdpMux::Worker::OnUdpSocketDataReceive(uint8_t* data,
+                                            size_t len,
+                                            udp::endpoint* remote_ep) {
+  auto listener = mux_->Find(data, len, remote_ep);
+  if (listener)
+    listener->OnUdpMuxDataReceive(data, len, remote_ep);
+}
+
+// The socket is shared by all viewers, so nothing is closed here. It keeps
+// receiving after errors it survives, like an ICMP error from one remote.
+void UdpMux::Worker::OnUdpSocketError() {
+  spdlog::warn("Udp mux socket error.");
+}
+
+UdpMux& UdpMux::GetInstance() {
+  static UdpMux udp_mux;
+  return udp_mux;
+}
+
+bool UdpMux::Start(boost::string_view ip, uint16_t port, size_t socket_count) {
+  if (socket_count == 0)
+    socket_count = 1;
+
+  for (size_t i = 0; i < socket_count; ++i) {
+    std::unique_ptr<Worker> worker(new Worker(this));
+    worker->udp_socket_.reset(
+        new UdpSocket(worker->message_loop_, worker.get(), 5000));
+    worker->udp_socket_->SetMinMaxPort(port, port);
+    worker->udp_socket_->SetReusePort(true);
+    worker->udp_socket_->SetSendBatchSize(
+        ServerConfig::GetInstance().GetUdpSendBatchSize());
+    worker->udp_socket_->SetEnableGso(
+        ServerConfig::GetInstance().GetEnableUdpGso());
+    worker->udp_socket_->SetReceiveBatchSize(
+        ServerConfig::GetInstance().GetUdpRecvBatchSize());
+    if (!worker->udp_socket_->Listen(ip)) {
+      spdlog::error("Udp mux failed to listen on port {}.", port);
+      Stop();
+      return false;
+    }
+    workers_.push_back(std::move(worker));
+  }
+
+  for (auto& worker : workers_) {
+    Worker* w = worker.get();
+    w->work_thread_ = std::thread([w]() { w->message_loop_.run(); });
+  }
+  port_ = port;
+  spdlog::info("Udp mux is listening on port {} with {} sockets.", port,
+               workers_.size());
+  return true;
+}
+
+void UdpMux::Stop() {
+  for (auto& worker : workers_) {
+    worker->message_loop_.stop();
+    if (worker->work_thread_.joinable())
+      worker->work_thread_.join();
+    worker->udp_socket_->Close();
+  }
+  workers_.clear();
+}
+
+uint16_t UdpMux::GetListeningPort() const {
+  return port_;
+}
+
+bool UdpMux::AddUfrag(const std::string& ufrag,
+                      std::weak_ptr<Listener> listener) {
+  auto key = listener.lock();
+  if (!key)
+    return false;
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto result = ufrags_.find(ufrag);
+  if (result != ufrags_.end() && !result->second.listener.expired())
+    return false;
+  ufrags_[ufrag] = {key.get(), listener};
+  return true;
+}
+
+void UdpMux::AddEndpoint(const udp::endpoint& endpoint,
+                         std::weak_ptr<Listener> listener) {
+  auto key = listener.lock();
+  if (!key)
+    return;
+  std::lock_guard<std::mutex> guard(mutex_);
+  endpoints_[endpoint] = {key.get(), listener};
+}
+
+void UdpMux::Remove(Listener* listener) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto iter = ufrags_.begin(); iter != ufrags_.end();) {
+    if (iter->second.key == listener)
+      iter = ufrags_.erase(iter);
+    else
+      ++iter;
+  }
+
+  for (auto iter = endpoints_.begin(); iter != endpoints_.end();) {
+    if (iter->second.key == listener)
+      iter = endpoints_.erase(iter);
+    else
+      ++iter;
+  }
+}
+
+void UdpMux::SendData(const uint8_t* data,
+                      size_t len,
+                      const udp::endpoint& endpoint) {
+  auto buffer = PacketBufferPool::GetInstance().Acquire(len);
+  memcpy(buffer->Data(), data, len);
+  buffer->SetSize(len);
+  SendData(std::move(buffer), endpoint);
+}
+
+void UdpMux::SendData(PacketBuffer::Pointer buffer,
+                      const udp::endpoint& endpoint) {
+  if (workers_.empty())
+    return;
+  // All sockets share the local port, so any of them can send. Keep one
+  // remote on one socket to preserve the order of its packets.
+  size_t hash = endpoint.port();
+  if (endpoint.address().is_v4())
+    hash ^= endpoint.address().to_v4().to_uint();
+  size_t index = hash % workers_.size();
+  Worker* worker = workers_[index].get();
+
+  boost::asio::post(worker->message_loop_, [worker, buffer = std::move(buffer),
+                                            endpoint]() mutable {
+    worker->udp_socket_->SendData(std::move(buffer), endpoint);
+  });
+}
+
+std::shared_ptr<UdpMux::Listener> UdpMux::Find(uint8_t* data,
+                                               size_t len,
+                                               udp::endpoint* remote_ep) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto endpoint_result = endpoints_.find(*remote_ep);
+  if (endpoint_result != endpoints_.end())
+    return endpoint_result->second.listener.lock();
+
+  boost::string_view username;
+  if (!StunMessage::IsStun(data, len) ||
+      !StunMessage::FindUsername(data, len, &username)) {
+    spdlog::debug("Drop packet from unknown remote [ip: {}, port {}].",
+                  remote_ep->address().to_string(), remote_ep->port());
+    return nullptr;
+  }
+
+  // USERNAME is "local ufrag:remote ufrag".
+  auto pos = username.find(':');
+  if (pos == boost::string_view::npos)
+    return nullptr;
+  auto ufrag_result = ufrags_.find(username.substr(0, pos).to_string());
+  if (ufrag_result == ufrags_.end())
+    return nullptr;
+  return ufrag_result->second.listener.lock();
+}
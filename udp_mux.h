@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include "packet_buffer.h"
+#include "udp_socket.h"
+
+/**
+ * @brief A few sockets bound to one port and shared by all webrtc transports.
+ *
+ * Datagrams are routed by the remote endpoint once it is known, otherwise a
+ * STUN request is routed by the local ufrag found in its USERNAME.
+ */
+class UdpMux {
+ public:
+  class Listener {
+   public:
+    virtual ~Listener() = default;
+    // Called on a mux thread, |data| is only valid during the call.
+    virtual void OnUdpMuxDataReceive(uint8_t* data,
+                                     size_t len,
+                                     udp::endpoint* remote_ep) = 0;
+  };
+
+  static UdpMux& GetInstance();
+
+  bool Start(boost::string_view ip, uint16_t port, size_t socket_count);
+  void Stop();
+  uint16_t GetListeningPort() const;
+
+  /**
+   * @brief Route STUN requests whose USERNAME starts with |ufrag|.
+   *
+   * @return false if |ufrag| is used by another listener.
+   */
+  bool AddUfrag(const std::string& ufrag, std::weak_ptr<Listener> listener);
+
+  /**
+   * @brief Route everything coming from |endpoint| to |listener|.
+   */
+  void AddEndpoint(const udp::endpoint& endpoint,
+                   std::weak_ptr<Listener> listener);
+
+  /**
+   * @brief Remove all routes of |listener|.
+   */
+  void Remove(Listener* listener);
+
+  // Thread safe, |data| is copied.
+  void SendData(const uint8_t* data, size_t len, const udp::endpoint& endpoint);
+  // Thread safe, takes |buffer| over.
+  void SendData(PacketBuffer::Pointer buffer, const udp::endpoint& endpoint);
+
+ private:
+  class Worker : public UdpSocket::Observer {
+   public:
+    explicit Worker(UdpMux* mux);
+    void OnUdpSocketDataReceive(uint8_t* data,
+                                size_t len,
+                                udp::endpoint* remote_ep) override;
+    void OnUdpSocketError() override;
+
+    UdpMux* mux_;
+    boost::asio::io_context message_loop_;
+    std::unique_ptr<UdpSocket> udp_socket_;
+    std::thread work_thread_;
+  };
+
+  struct Route {
+    Listener* key;
+    std::weak_ptr<Listener> listener;
+  };
+
+  UdpMux() = default;
+  std::shared_ptr<Listener> Find(uint8_t* data,
+                                 size_t len,
+                                 udp::endpoint* remote_ep);
+  std::mutex mutex_;
+  std::map<std::string, Route> ufrags_;
+  std::map<udp::endpoint, Route> endpoints_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  uint16_t port_{0};
+};
@@ -1,7 +1,36 @@
 #include "udp_socket.h"
+#include "metrics.h"
 #include "spdlog/spdlog.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// Limits of one GSO send, see UDP_MAX_SEGMENTS in the kernel.
+static constexpr size_t kMaxGsoSegments = 64;
+static constexpr size_t kMaxGsoBytes = 65000;
+// GSO sends in a row that only went out as single datagrams before GSO is
+// turned off for the socket.
+static constexpr size_t kMaxGsoFallbacks = 3;
+// Batches drained per wakeup before giving other handlers a turn.
+static constexpr size_t kMaxReceiveRounds = 4;
+
+// Errors of a single datagram or reported by ICMP for some remote, the
+// socket keeps working after them.
+static bool IsTransientReceiveError(const boost::system::error_code& ec) {
+  return ec == boost::asio::error::connection_refused ||
+         ec == boost::asio::error::connection_reset ||
+         ec == boost::asio::error::host_unreachable ||
+         ec == boost::asio::error::network_unreachable ||
+         ec == boost::asio::error::no_buffer_space ||
+         ec == boost::asio::error::no_memory;
+}
 
 UdpSocket::UdpSocket(boost::asio::io_context& io_context,
                      Observer* listener,
@@ -11,18 +40,30 @@ UdpSocket::UdpSocket(boost::asio::io_context& io_context,
       listener_(listener),
       max_port_(65535),
       min_port_(0),
-      init_receive_buffer_size_(init_receive_buffer_size) {}
+      init_receive_buffer_size_(init_receive_buffer_size) {
+  SetSendBatchSize(kDefaultSendBatchSize);
+}
 
 UdpSocket::~UdpSocket() {
   Close();
+  Metrics::GetInstance().udp_send_queue_packets.Add(
+      -static_cast<int64_t>(SendQueueSize()));
 }
 
+using reuse_port =
+    boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
 bool UdpSocket::Listen(boost::string_view ip) {
-  for (uint16_t i = min_port_; i <= max_port_; ++i) {
+  for (uint32_t i = min_port_; i <= max_port_; ++i) {
     try {
-      socket_.reset(new udp::socket(
-          io_context_,
-          udp::endpoint(boost::asio::ip::address::from_string(ip.data()), i)));
+      udp::endpoint endpoint(boost::asio::ip::address::from_string(ip.data()),
+                             i);
+      std::unique_ptr<udp::socket> socket(
+          new udp::socket(io_context_, endpoint.protocol()));
+      if (reuse_port_)
+        socket->set_option(reuse_port(true));
+      socket->bind(endpoint);
+      socket_ = std::move(socket);
       spdlog::debug("Select port {}.", i);
       break;
     }
@@ -31,6 +72,16 @@ bool UdpSocket::Listen(boost::string_view ip) {
     }
   }
 
+  if (socket_ && gso_enabled_) {
+    int gso_size = 0;
+    socklen_t option_len = sizeof(gso_size);
+    if (getsockopt(socket_->native_handle(), IPPROTO_UDP, UDP_SEGMENT,
+                   &gso_size, &option_len) < 0) {
+      spdlog::warn("UDP GSO is not supported by the kernel.");
+      SetEnableGso(false);
+    }
+  }
+
   if (socket_)
     StartReceive();
 
@@ -40,25 +91,44 @@ bool UdpSocket::Listen(boost::string_view ip) {
 }
 
 void UdpSocket::SendData(const uint8_t* buf, size_t len, udp::endpoint* endpoint) {
+  auto buffer = PacketBufferPool::GetInstance().Acquire(len);
+  memcpy(buffer->Data(), buf, len);
+  buffer->SetSize(len);
+  SendData(std::move(buffer), *endpoint);
+}
+
+void UdpSocket::SendData(PacketBuffer::Pointer buffer,
+                         const udp::endpoint& endpoint) {
   UdpMessage data;
-  data.buffer.reset(new uint8_t[len]);
-  memcpy(data.buffer.get(), buf, len);
-  data.length = len;
-  data.endpoint = *endpoint;
+  data.buffer = std::move(buffer);
+  data.endpoint = endpoint;
 
-  send_queue_.push(data);
-  if (send_queue_.size() == 1)
+  send_queue_.push_back(std::move(data));
+  Metrics::GetInstance().udp_send_queue_packets.Add(1);
+  if (SendQueueSize() == 1)
     DoSend();
 }
 
 void UdpSocket::DoSend() {
   if (is_closing_)
     return;
-  UdpMessage& data = send_queue_.front();
+
+  if (send_batch_size_ > 1 || gso_enabled_) {
+    // Wait until the current handler is done, so that everything it queued
+    // goes out in as few sendmmsg calls as possible.
+    socket_->async_wait(
+        udp::socket::wait_write,
+        boost::bind(&UdpSocket::HandleWritable, this,
+                    boost::asio::placeholders::error));
+    return;
+  }
+
+  UdpMessage& data = send_queue_[send_queue_head_];
 
   boost::system::error_code ignored_error;
   socket_->async_send_to(
-      boost::asio::buffer(data.buffer.get(), data.length), data.endpoint,
+      boost::asio::buffer(data.buffer->Data(), data.buffer->Size()),
+      data.endpoint,
       boost::bind(&UdpSocket::HandSend, this, boost::asio::placeholders::error,
                   boost::asio::placeholders::bytes_transferred));
 }
@@ -72,13 +142,196 @@ void UdpSocket::HandSend(const boost::system::error_code& ec,
       listener_->OnUdpSocketError();
   }
 
-  assert(send_queue_.size() > 0);
-  send_queue_.pop();
+  assert(SendQueueSize() > 0);
+  PopSendQueue(1, !ec);
 
-  if (send_queue_.size() > 0)
+  if (SendQueueSize() > 0)
     DoSend();
 }
 
+void UdpSocket::HandleWritable(const boost::system::error_code& ec) {
+  if (is_closing_)
+    return;
+  if (ec) {
+    if (listener_)
+      listener_->OnUdpSocketError();
+    if (is_closing_)
+      return;
+    // Carry on like HandSend. A send that fails again drops its datagrams,
+    // so the queue drains instead of stalling every later send.
+  }
+
+  if (!FlushSendQueue())
+    DoSend();
+}
+
+size_t UdpSocket::CountGsoSegments(size_t start) const {
+  start += send_queue_head_;
+  const UdpMessage& first = send_queue_[start];
+  size_t segment_size = first.buffer->Size();
+  size_t count = 1;
+  size_t bytes = segment_size;
+  for (size_t i = start + 1;
+       i < send_queue_.size() && count < kMaxGsoSegments; ++i) {
+    const UdpMessage& data = send_queue_[i];
+    size_t length = data.buffer->Size();
+    if (data.endpoint != first.endpoint || length > segment_size ||
+        bytes + length > kMaxGsoBytes)
+      break;
+    ++count;
+    bytes += length;
+    // Only the last segment may be shorter than the segment size.
+    if (length < segment_size)
+      break;
+  }
+  return count;
+}
+
+bool UdpSocket::FlushSendQueue() {
+  while (SendQueueSize() > 0 && !is_closing_) {
+    // |queue_index| counts from the first datagram not sent yet.
+    UdpMessage* pending = &send_queue_[send_queue_head_];
+    size_t msg_count = 0;
+    size_t queue_index = 0;
+    while (msg_count < send_batch_size_ && queue_index < SendQueueSize()) {
+      size_t segments = gso_enabled_ && queue_index >= gso_retry_datagrams_
+                            ? CountGsoSegments(queue_index)
+                            : 1;
+      UdpMessage& data = pending[queue_index];
+      for (size_t i = 0; i < segments; ++i) {
+        send_iovecs_[queue_index + i].iov_base =
+            pending[queue_index + i].buffer->Data();
+        send_iovecs_[queue_index + i].iov_len =
+            pending[queue_index + i].buffer->Size();
+      }
+
+      msghdr& hdr = send_msgs_[msg_count].msg_hdr;
+      hdr.msg_name = data.endpoint.data();
+      hdr.msg_namelen = data.endpoint.size();
+      hdr.msg_iov = &send_iovecs_[queue_index];
+      hdr.msg_iovlen = segments;
+      hdr.msg_flags = 0;
+      if (segments > 1) {
+        // The kernel splits the payload back into datagrams of the size of
+        // the first one.
+        GsoControl& control = gso_controls_[msg_count];
+        hdr.msg_control = control.buffer;
+        hdr.msg_controllen = sizeof(control.buffer);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = data.buffer->Size();
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+      } else {
+        hdr.msg_control = nullptr;
+        hdr.msg_controllen = 0;
+      }
+      send_msg_segments_[msg_count] = segments;
+      queue_index += segments;
+      ++msg_count;
+    }
+
+    int sent = sendmmsg(socket_->native_handle(), send_msgs_.data(),
+                        msg_count, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return false;
+      if (errno == EINTR)
+        continue;
+      if (send_msg_segments_[0] > 1 &&
+          (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+        // Either the route cannot offload segmentation or the kernel
+        // rejects this one message, resend its datagrams one by one.
+        if (!gso_fallback_logged_) {
+          spdlog::warn("UDP GSO was rejected, err = {}. Resend without it.",
+                       strerror(errno));
+          gso_fallback_logged_ = true;
+        }
+        gso_retry_datagrams_ = send_msg_segments_[0];
+        continue;
+      }
+      // The first message is the one that failed, drop it like HandSend.
+      spdlog::warn("sendmmsg failed. err = {}", strerror(errno));
+      PopSendQueue(send_msg_segments_[0], false);
+      if (listener_)
+        listener_->OnUdpSocketError();
+      continue;
+    }
+
+    size_t packets = 0;
+    for (int i = 0; i < sent; ++i) {
+      packets += send_msg_segments_[i];
+      if (send_msg_segments_[i] > 1) {
+        gso_packets_.fetch_add(send_msg_segments_[i],
+                               std::memory_order_relaxed);
+        gso_fallbacks_ = 0;
+      }
+    }
+    // A rejected GSO send went out as single datagrams. Only the route is
+    // to blame if that keeps happening.
+    if (gso_retry_datagrams_ > 0 && packets >= gso_retry_datagrams_ &&
+        ++gso_fallbacks_ >= kMaxGsoFallbacks && gso_enabled_) {
+      spdlog::warn("UDP GSO keeps being rejected. Disable it.");
+      SetEnableGso(false);
+    }
+    PopSendQueue(packets, true);
+  }
+  return true;
+}
+
+size_t UdpSocket::SendQueueSize() const {
+  return send_queue_.size() - send_queue_head_;
+}
+
+void UdpSocket::PopSendQueue(size_t count, bool sent) {
+  Metrics& metrics = Metrics::GetInstance();
+  size_t bytes = 0;
+  for (size_t i = send_queue_head_; i < send_queue_head_ + count; ++i) {
+    bytes += send_queue_[i].buffer->Size();
+    // Back to the pool now, not when the queue is compacted.
+    send_queue_[i].buffer.reset();
+  }
+  if (sent) {
+    metrics.egress_packets.Add(count);
+    metrics.egress_bytes.Add(bytes);
+  }
+  metrics.udp_send_queue_packets.Add(-static_cast<int64_t>(count));
+  send_queue_head_ += count;
+  gso_retry_datagrams_ -= std::min(count, gso_retry_datagrams_);
+  // Moving the rest to the front costs no more than the datagrams taken off
+  // since the last move, so every datagram is moved O(1) times.
+  if (send_queue_head_ >= SendQueueSize()) {
+    send_queue_.erase(send_queue_.begin(),
+                      send_queue_.begin() + send_queue_head_);
+    send_queue_head_ = 0;
+  }
+  UpdateSendStats(count);
+}
+
+void UdpSocket::UpdateSendStats(size_t batch_size) {
+  send_packets_.fetch_add(batch_size, std::memory_order_relaxed);
+  send_syscalls_.fetch_add(1, std::memory_order_relaxed);
+  if (batch_size > max_send_batch_size_.load(std::memory_order_relaxed))
+    max_send_batch_size_.store(batch_size, std::memory_order_relaxed);
+}
+
+UdpSocket::SendStats UdpSocket::GetSendStats() const {
+  SendStats stats;
+  stats.packets = send_packets_.load(std::memory_order_relaxed);
+  stats.syscalls = send_syscalls_.load(std::memory_order_relaxed);
+  stats.max_batch_size = max_send_batch_size_.load(std::memory_order_relaxed);
+  stats.gso_packets = gso_packets_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+UdpSocket::ReceiveStats UdpSocket::GetReceiveStats() const {
+  ReceiveStats stats;
+  stats.packets = receive_packets_.load(std::memory_order_relaxed);
+  stats.syscalls = receive_syscalls_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 void UdpSocket::Close() {
   if (is_closing_)
     return;
@@ -99,12 +352,21 @@ unsigned short UdpSocket::GetListeningPort() {
 }
 
 void UdpSocket::StartReceive() {
-  if (!receive_data_.buffer)
-    receive_data_.buffer.reset(new uint8_t[init_receive_buffer_size_]);
   assert(socket_);
+  if (recv_batch_size_ > 1) {
+    socket_->async_wait(
+        udp::socket::wait_read,
+        boost::bind(&UdpSocket::HandleReadable, this,
+                    boost::asio::placeholders::error));
+    return;
+  }
+
+  if (!receive_data_.buffer)
+    receive_data_.buffer =
+        PacketBufferPool::GetInstance().Acquire(init_receive_buffer_size_);
 
   socket_->async_receive_from(
-      boost::asio::buffer(receive_data_.buffer.get(),
+      boost::asio::buffer(receive_data_.buffer->Data(),
                           init_receive_buffer_size_),
       receive_data_.endpoint,
       boost::bind(&UdpSocket::HandleReceive, this,
@@ -118,13 +380,19 @@ void UdpSocket::HandleReceive(const boost::system::error_code& ec,
     return;
   if (!ec || ec == boost::asio::error::message_size) {
     if (listener_)
-      listener_->OnUdpSocketDataReceive(receive_data_.buffer.get(), bytes,
+      listener_->OnUdpSocketDataReceive(receive_data_.buffer->Data(), bytes,
                                  &receive_data_.endpoint);
+    receive_packets_.fetch_add(1, std::memory_order_relaxed);
+    receive_syscalls_.fetch_add(1, std::memory_order_relaxed);
     StartReceive();
     return;
   } else {
     if (listener_)
       listener_->OnUdpSocketError();
+    // A listener that gives up closes the socket, which cancels the receive
+    // armed here.
+    if (!is_closing_ && IsTransientReceiveError(ec))
+      StartReceive();
   }
 }
 
@@ -132,3 +400,97 @@ void UdpSocket::SetMinMaxPort(uint16_t min, uint16_t max) {
   min_port_ = min;
   max_port_ = max;
 }
+
+void UdpSocket::SetReusePort(bool reuse_port) {
+  reuse_port_ = reuse_port;
+}
+
+void UdpSocket::SetSendBatchSize(size_t batch_size) {
+  send_batch_size_ = std::max<size_t>(batch_size, 1);
+  send_msgs_.resize(send_batch_size_);
+  send_msg_segments_.resize(send_batch_size_);
+  gso_controls_.resize(gso_enabled_ ? send_batch_size_ : 0);
+  send_iovecs_.resize(send_batch_size_ *
+                      (gso_enabled_ ? kMaxGsoSegments : 1));
+}
+
+void UdpSocket::SetReceiveBatchSize(size_t batch_size) {
+  recv_batch_size_ = std::max<size_t>(batch_size, 1);
+  if (recv_batch_size_ == 1)
+    return;
+
+  receive_ring_.reset(
+      new uint8_t[recv_batch_size_ * init_receive_buffer_size_]);
+  recv_msgs_.resize(recv_batch_size_);
+  recv_iovecs_.resize(recv_batch_size_);
+  recv_endpoints_.resize(recv_batch_size_);
+  for (size_t i = 0; i < recv_batch_size_; ++i) {
+    recv_iovecs_[i].iov_base =
+        receive_ring_.get() + i * init_receive_buffer_size_;
+    recv_iovecs_[i].iov_len = init_receive_buffer_size_;
+  }
+}
+
+void UdpSocket::HandleReadable(const boost::system::error_code& ec) {
+  if (is_closing_)
+    return;
+  if (ec) {
+    if (listener_)
+      listener_->OnUdpSocketError();
+    if (!is_closing_ && IsTransientReceiveError(ec))
+      StartReceive();
+    return;
+  }
+
+  for (size_t round = 0; round < kMaxReceiveRounds; ++round) {
+    for (size_t i = 0; i < recv_batch_size_; ++i) {
+      msghdr& hdr = recv_msgs_[i].msg_hdr;
+      hdr.msg_name = recv_endpoints_[i].data();
+      hdr.msg_namelen = recv_endpoints_[i].capacity();
+      hdr.msg_iov = &recv_iovecs_[i];
+      hdr.msg_iovlen = 1;
+      hdr.msg_control = nullptr;
+      hdr.msg_controllen = 0;
+      hdr.msg_flags = 0;
+    }
+
+    int received = recvmmsg(socket_->native_handle(), recv_msgs_.data(),
+                            recv_batch_size_, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno == EINTR)
+        continue;
+      boost::system::error_code error(errno,
+                                      boost::system::system_category());
+      spdlog::warn("recvmmsg failed. err = {}", error.message());
+      if (listener_)
+        listener_->OnUdpSocketError();
+      if (!is_closing_ && IsTransientReceiveError(error))
+        StartReceive();
+      return;
+    }
+
+    receive_packets_.fetch_add(received, std::memory_order_relaxed);
+    receive_syscalls_.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 0; i < received && !is_closing_; ++i) {
+      recv_endpoints_[i].resize(recv_msgs_[i].msg_hdr.msg_namelen);
+      if (listener_)
+        listener_->OnUdpSocketDataReceive(
+            static_cast<uint8_t*>(recv_iovecs_[i].iov_base),
+            recv_msgs_[i].msg_len, &recv_endpoints_[i]);
+    }
+
+    if (is_closing_)
+      return;
+    if (static_cast<size_t>(received) < recv_batch_size_)
+      break;
+  }
+
+  StartReceive();
+}
+
+void UdpSocket::SetEnableGso(bool enable) {
+  gso_enabled_ = enable;
+  SetSendBatchSize(send_batch_size_);
+}
@@ -1,15 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <vector>
 #include <cstddef>
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
-#include <boost/shared_array.hpp>
 #include <boost/utility/string_view.hpp>
 
+#include "packet_buffer.h"
+
 using udp = boost::asio::ip::udp;
 
 class UdpSocket {
@@ -23,6 +25,22 @@ class UdpSocket {
     virtual void OnUdpSocketError() = 0;
   };
 
+  struct SendStats {
+    uint64_t packets{0};
+    // Number of send syscalls, packets / syscalls is the average batch size.
+    uint64_t syscalls{0};
+    uint64_t max_batch_size{0};
+    // Packets that left as segments of a UDP GSO send.
+    uint64_t gso_packets{0};
+  };
+
+  struct ReceiveStats {
+    uint64_t packets{0};
+    uint64_t syscalls{0};
+  };
+
+  static constexpr size_t kDefaultSendBatchSize = 32;
+
   UdpSocket(boost::asio::io_context& io_context,
             Observer* listener,
             size_t init_receive_buffer_size);
@@ -31,30 +49,94 @@ class UdpSocket {
   ~UdpSocket();
 
   void SetMinMaxPort(uint16_t min, uint16_t max);
+  // Allow several sockets to bind the same port (SO_REUSEPORT), the kernel
+  // then spreads the remote 4-tuples over them. Must be set before Listen.
+  void SetReusePort(bool reuse_port);
+  // Maximum number of datagrams handed to one sendmmsg call, 1 sends the
+  // queue one datagram at a time.
+  void SetSendBatchSize(size_t batch_size);
+  // Send runs of equal-size datagrams to one remote as a single UDP_SEGMENT
+  // (GSO) message. Falls back to plain sendmmsg if the kernel rejects it.
+  void SetEnableGso(bool enable);
+  // Read up to |batch_size| datagrams per wakeup with recvmmsg into a ring
+  // allocated once, 1 keeps a single async_receive_from. Must be set before
+  // Listen.
+  void SetReceiveBatchSize(size_t batch_size);
   bool Listen(boost::string_view ip);
   void SendData(const uint8_t*, size_t len, udp::endpoint* endpoint);
+  // Takes |buffer| over instead of copying it.
+  void SendData(PacketBuffer::Pointer buffer, const udp::endpoint& endpoint);
   unsigned short GetListeningPort();
   void Close();
+  // Safe to call from any thread.
+  SendStats GetSendStats() const;
+  ReceiveStats GetReceiveStats() const;
 
  private:
   struct UdpMessage {
-    boost::shared_array<uint8_t> buffer;
-    size_t length;
+    PacketBuffer::Pointer buffer;
     udp::endpoint endpoint;
   };
 
   void DoSend();
   void StartReceive();
   void HandSend(const boost::system::error_code& ec, size_t bytes);
+  void HandleWritable(const boost::system::error_code& ec);
+  // Drains |send_queue_| with sendmmsg, returns false if the socket would
+  // block.
+  bool FlushSendQueue();
+  // Number of datagrams from |start| that can share one GSO send, |start|
+  // counts from the first datagram not sent yet.
+  size_t CountGsoSegments(size_t start) const;
+  // Datagrams queued and not sent yet.
+  size_t SendQueueSize() const;
+  // Takes the first |count| datagrams off |send_queue_| after a send call,
+  // |sent| is false if they were dropped.
+  void PopSendQueue(size_t count, bool sent);
+  void UpdateSendStats(size_t batch_size);
   void HandleReceive(const boost::system::error_code&, size_t bytes);
+  void HandleReadable(const boost::system::error_code& ec);
   size_t init_receive_buffer_size_;
   std::unique_ptr<udp::socket> socket_;
   udp::endpoint remote_endpoint_;
   bool is_closing_;
   Observer* listener_;
   UdpMessage receive_data_;
-  std::queue<UdpMessage> send_queue_;
+  // A vector keeps its capacity, so queueing allocates nothing once warm.
+  // Sent datagrams are only skipped by |send_queue_head_| and moved out in
+  // one go later, erasing each batch from the front would be quadratic in
+  // a backlog.
+  std::vector<UdpMessage> send_queue_;
+  size_t send_queue_head_{0};
   boost::asio::io_context& io_context_;
   uint16_t max_port_;
   uint16_t min_port_;
+  bool reuse_port_{false};
+  size_t send_batch_size_{kDefaultSendBatchSize};
+  struct GsoControl {
+    alignas(cmsghdr) char buffer[CMSG_SPACE(sizeof(uint16_t))];
+  };
+  bool gso_enabled_{false};
+  // Leading datagrams of the queue to send without GSO, after the kernel
+  // rejected them as one GSO message.
+  size_t gso_retry_datagrams_{0};
+  // Rejected GSO sends in a row whose datagrams then went out one by one.
+  size_t gso_fallbacks_{0};
+  bool gso_fallback_logged_{false};
+  std::vector<mmsghdr> send_msgs_;
+  std::vector<size_t> send_msg_segments_;
+  std::vector<GsoControl> gso_controls_;
+  // Indexed like |send_queue_|, a GSO message points into a run of it.
+  std::vector<iovec> send_iovecs_;
+  std::atomic<uint64_t> send_packets_{0};
+  std::atomic<uint64_t> send_syscalls_{0};
+  std::atomic<uint64_t> max_send_batch_size_{0};
+  std::atomic<uint64_t> gso_packets_{0};
+  size_t recv_batch_size_{1};
+  std::unique_ptr<uint8_t[]> receive_ring_;
+  std::vector<mmsghdr> recv_msgs_;
+  std::vector<iovec> recv_iovecs_;
+  std::vector<udp::endpoint> recv_endpoints_;
+  std::atomic<uint64_t> receive_packets_{0};
+  std::atomic<uint64_t> receive_syscalls_{0};
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "ulpfec_generator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "byte_buffer.h"
+#include "rtp_packet.h"
+
+UlpfecGenerator::UlpfecGenerator()
+    : slab_{new uint8_t[kMaxMediaPackets * kMaxMediaPacketSize]} {}
+
+void UlpfecGenerator::SetFractionLost(uint8_t fraction_lost) {
+  // Twice the loss, so a loss burst within a group is still recovered.
+  double protection = 2 * fraction_lost / 256.0;
+  if (fraction_lost == 0)
+    protection = 0;
+  else if (protection < kMinProtection)
+    protection = kMinProtection;
+  else if (protection > kMaxProtection)
+    protection = kMaxProtection;
+  protection_ = protection;
+}
+
+size_t UlpfecGenerator::AddMediaPacket(const uint8_t* data, size_t size) {
+  if (group_complete_)
+    ResetGroup();
+  if (protection_ == 0) {
+    ResetGroup();
+    return 0;
+  }
+  if (size < kRtpHeaderFixedSize || size > kMaxMediaPacketSize)
+    return 0;
+
+  uint16_t sequence_number = LoadUInt16BE(data + 2);
+  if (media_count_ == 0)
+    base_sequence_number_ = sequence_number;
+  // The mask can not reach it, give up the group.
+  if (static_cast<uint16_t>(sequence_number - base_sequence_number_) >=
+      kMaxMediaPackets) {
+    ResetGroup();
+    base_sequence_number_ = sequence_number;
+  }
+
+  memcpy(slab_.get() + media_count_ * kMaxMediaPacketSize, data, size);
+  sizes_[media_count_++] = size;
+
+  bool marker = data[1] & 0x80;
+  size_t fec_count = static_cast<size_t>(media_count_ * protection_ + 0.5);
+  if (media_count_ == kMaxMediaPackets)
+    fec_count = std::max<size_t>(fec_count, 1);
+  else if (!marker || fec_count == 0)
+    return 0;
+  fec_count_ = fec_count;
+  group_complete_ = true;
+  return fec_count_;
+}
+
+size_t UlpfecGenerator::WriteFecPacket(size_t index, uint8_t* out) const {
+  // https://tools.ietf.org/html/rfc5109#section-7.3
+  //  0                   1                   2                   3
+  //  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |E|L|P|X|  CC   |M| PT recovery |            SN base            |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |                          TS recovery                          |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |        length recovery        |       Protection Length       |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  // |             mask              |
+  // +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+  if (index >= fec_count_)
+    return 0;
+
+  // The first packet protected by this FEC packet.
+  uint16_t sn_base =
+      LoadUInt16BE(slab_.get() + index * kMaxMediaPacketSize + 2);
+  size_t protection_length = 0;
+  for (size_t i = index; i < media_count_; i += fec_count_)
+    protection_length =
+        std::max(protection_length, sizes_[i] - kRtpHeaderFixedSize);
+
+  memset(out, 0, kFecHeaderSize + protection_length);
+  uint32_t ts_recovery = 0;
+  uint16_t length_recovery = 0;
+  uint16_t mask = 0;
+  uint8_t* payload = out + kFecHeaderSize;
+  for (size_t i = index; i < media_count_; i += fec_count_) {
+    const uint8_t* media = slab_.get() + i * kMaxMediaPacketSize;
+    // P, X and CC, then M and PT.
+    out[0] ^= media[0] & 0x3f;
+    out[1] ^= media[1];
+    ts_recovery ^= LoadUInt32BE(media + 4);
+    length_recovery ^= sizes_[i] - kRtpHeaderFixedSize;
+    uint16_t offset = LoadUInt16BE(media + 2) - sn_base;
+    mask |= 0x8000 >> offset;
+    // CSRCs, header extension and payload are all protected.
+    for (size_t j = kRtpHeaderFixedSize; j < sizes_[i]; ++j)
+      payload[j - kRtpHeaderFixedSize] ^= media[j];
+  }
+  StoreUInt16BE(out + 2, sn_base);
+  StoreUInt32BE(out + 4, ts_recovery);
+  StoreUInt16BE(out + 8, length_recovery);
+  StoreUInt16BE(out + 10, protection_length);
+  StoreUInt16BE(out + 12, mask);
+  return kFecHeaderSize + protection_length;
+}
+
+void UlpfecGenerator::ResetGroup() {
+  media_count_ = 0;
+  fec_count_ = 0;
+  group_complete_ = false;
+}
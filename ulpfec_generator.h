@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Generates RFC 5109 ULPFEC for the video packets of one viewer.
+ *
+ * Media packets are collected into groups of up to 16 consecutive sequence
+ * numbers, closed at the end of a frame once the group is large enough for
+ * one FEC packet. FEC packet i of k protects every k-th media packet starting
+ * at i, so a burst of up to k losses in a group is recovered without a round
+ * trip. The number of FEC packets follows the loss reported by the receiver,
+ * nothing is generated while there is none. Runs on the loop of the transport.
+ */
+class UlpfecGenerator {
+ public:
+  // FEC header and a level 0 header with a 16 bit mask.
+  static constexpr size_t kFecHeaderSize = 14;
+  static constexpr size_t kMaxMediaPackets = 16;
+  // Larger media packets are left unprotected, so that RTP header, RED
+  // header and FEC still fit into the MTU.
+  static constexpr size_t kMaxMediaPacketSize = 1400;
+
+  UlpfecGenerator();
+
+  // |fraction_lost| of an RTCP report block, in 1/256.
+  void SetFractionLost(uint8_t fraction_lost);
+
+  /**
+   * @brief Add a media packet as the receiver sees it once RED is removed.
+   *
+   * @return The number of FEC packets to send right after it, written with
+   * WriteFecPacket.
+   */
+  size_t AddMediaPacket(const uint8_t* data, size_t size);
+
+  /**
+   * @brief Write the FEC header and payload of FEC packet |index| into
+   * |out|, which must hold kFecHeaderSize plus kMaxMediaPacketSize.
+   *
+   * @return The number of bytes written.
+   */
+  size_t WriteFecPacket(size_t index, uint8_t* out) const;
+
+ private:
+  static constexpr double kMaxProtection = 0.5;
+  static constexpr double kMinProtection = 0.1;
+
+  void ResetGroup();
+
+  std::unique_ptr<uint8_t[]> slab_;
+  size_t sizes_[kMaxMediaPackets];
+  size_t media_count_{0};
+  size_t fec_count_{0};
+  bool group_complete_{false};
+  uint16_t base_sequence_number_{0};
+  // FEC packets per media packet.
+  double protection_{0};
+};
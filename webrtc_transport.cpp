@@ -4,27 +4,184 @@
 #include "sdptransform/sdptransform.hpp"
 #include "dtls_context.h"
 #include "media_source_manager.h"
+#include "metrics.h"
 #include "webrtc_transport_manager.h"
 #include "server_config.h"
 #include "stun_message.h"
 
+static const char kTwccExtensionUri[] =
+    "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01";
+
+// Announced in the SDP and sent in the SDES of every RTCP compound packet.
+static const char kCname[] = "wvod";
+
+static std::atomic<uint64_t> next_viewer_id{0};
+
 WebrtcTransport::WebrtcTransport(const std::string& stream_id)
-    : connection_established_(false), stream_id_{stream_id} {}
+    : connection_established_(false),
+      event_loop_{EventLoopPool::GetInstance().Acquire()},
+      message_loop_{event_loop_->Context()},
+      stream_id_{stream_id},
+      id_{++next_viewer_id},
+      pending_packets_{ServerConfig::GetInstance().GetViewerQueueSize()} {
+  Metrics::GetInstance().viewers.Add(1);
+}
+
+// Called on the media source thread, which is shared by all viewers of the
+// stream, so it must never wait for this viewer.
+bool WebrtcTransport::AdmitMediaPacket(const MediaPacket& packet) {
+  if (!connection_established_) {
+    waiting_for_keyframe_ = true;
+    DropMediaPacket(packet);
+    return false;
+  }
+
+  if (packet.PacketType() == MediaPacket::Type::kVideo &&
+      waiting_for_keyframe_) {
+    if (!packet.IsKey()) {
+      DropMediaPacket(packet);
+      return false;
+    }
+    waiting_for_keyframe_ = false;
+  }
+  return true;
+}
 
 void WebrtcTransport::OnMediaPacketGenerated(MediaPacket::Pointer packet) {
-  latch_.wait();
-  if (connection_established_) {
-    if (packet->PacketType() == MediaPacket::Type::kVideo)
-      message_loop_.post(
-          std::bind(&WebrtcTransport::OnIncomingH264Packet, this, packet));
+  bool is_video = packet->PacketType() == MediaPacket::Type::kVideo;
+  if (!AdmitMediaPacket(*packet))
+    return;
+
+  if (!pending_packets_.push(packet)) {
+    if (is_video) {
+      spdlog::warn("Viewer of stream {} falls behind, wait for a keyframe.",
+                   stream_id_);
+      waiting_for_keyframe_ = true;
+    }
+    DropMediaPacket(*packet);
+    return;
+  }
+
+  if (!delivery_scheduled_.exchange(true)) {
+    std::weak_ptr<WebrtcTransport> weak_self = weak_self_;
+    message_loop_.post([weak_self]() {
+      auto self = weak_self.lock();
+      if (self)
+        self->DeliverPendingPackets();
+    });
+  }
+}
+
+void WebrtcTransport::DropMediaPacket(const MediaPacket& packet) {
+  if (packet.PacketType() == MediaPacket::Type::kVideo)
+    dropped_video_packets_.fetch_add(1, std::memory_order_relaxed);
+  else
+    dropped_audio_packets_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void WebrtcTransport::OnCachedPacketsGenerated(
+    std::list<MediaPacket::Pointer> packets) {
+  for (auto it = packets.begin(); it != packets.end();) {
+    if (AdmitMediaPacket(**it))
+      ++it;
     else
-      message_loop_.post(
-          std::bind(&WebrtcTransport::OnIncomingOpusPacket, this, packet));
-  } else {
-    spdlog::error(
-        "The connection was not established when the media package was "
-        "written.");
+      it = packets.erase(it);
   }
+  if (packets.empty())
+    return;
+
+  // The queue is still empty, live packets only follow this call, so the
+  // drain they schedule runs after the GOP.
+  std::weak_ptr<WebrtcTransport> weak_self = weak_self_;
+  message_loop_.post([weak_self, packets]() {
+    auto self = weak_self.lock();
+    if (!self || self->closed_)
+      return;
+    for (auto& packet : packets)
+      self->DeliverMediaPacket(packet);
+    self->delivered_packets_.fetch_add(packets.size(),
+                                       std::memory_order_relaxed);
+  });
+}
+
+void WebrtcTransport::DeliverMediaPacket(MediaPacket::Pointer packet) {
+  if (packet->PacketType() == MediaPacket::Type::kVideo)
+    OnIncomingH264Packet(packet);
+  else
+    OnIncomingOpusPacket(packet);
+}
+
+void WebrtcTransport::DeliverPendingPackets() {
+  if (closed_)
+    return;
+  // Clear the flag before draining, a packet pushed after the drain then
+  // schedules the next one.
+  delivery_scheduled_ = false;
+  size_t count =
+      pending_packets_.consume_all([this](MediaPacket::Pointer packet) {
+        DeliverMediaPacket(packet);
+      });
+  delivered_packets_.fetch_add(count, std::memory_order_relaxed);
+}
+
+uint64_t WebrtcTransport::GetId() const {
+  return id_;
+}
+
+const std::string& WebrtcTransport::GetStreamId() const {
+  return stream_id_;
+}
+
+WebrtcTransport::DeliveryStats WebrtcTransport::GetDeliveryStats() const {
+  DeliveryStats stats;
+  stats.delivered_packets = delivered_packets_.load(std::memory_order_relaxed);
+  stats.dropped_video_packets =
+      dropped_video_packets_.load(std::memory_order_relaxed);
+  stats.dropped_audio_packets =
+      dropped_audio_packets_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+size_t WebrtcTransport::GetRetransmissionMemory() const {
+  return media_stream_ ? media_stream_->GetRetransmissionMemory() : 0;
+}
+
+uint32_t WebrtcTransport::GetTargetBitrate() const {
+  return target_bitrate_.load(std::memory_order_relaxed);
+}
+
+Pacer::Stats WebrtcTransport::GetPacerStats() const {
+  return media_stream_ ? media_stream_->GetPacerStats() : Pacer::Stats();
+}
+
+H264Thinner::Stats WebrtcTransport::GetThinningStats() const {
+  return media_stream_ ? media_stream_->GetThinningStats()
+                       : H264Thinner::Stats();
+}
+
+StreamTrack::Stats WebrtcTransport::GetVideoStats() const {
+  return media_stream_ ? media_stream_->GetVideoStats() : StreamTrack::Stats();
+}
+
+StreamTrack::Stats WebrtcTransport::GetAudioStats() const {
+  return media_stream_ ? media_stream_->GetAudioStats() : StreamTrack::Stats();
+}
+
+uint32_t WebrtcTransport::GetEgressBitrate() const {
+  return media_stream_ ? media_stream_->GetEgressBitrate() : 0;
+}
+
+WebrtcTransport::Stats WebrtcTransport::GetStats() const {
+  Stats stats;
+  stats.id = GetId();
+  stats.stream_id = stream_id_;
+  stats.video = GetVideoStats();
+  stats.audio = GetAudioStats();
+  stats.egress_bitrate = GetEgressBitrate();
+  stats.target_bitrate = GetTargetBitrate();
+  stats.pacer = GetPacerStats();
+  stats.delivery = GetDeliveryStats();
+  return stats;
 }
 
 void WebrtcTransport::OnMediaSouceEnd() {
@@ -32,22 +189,41 @@ void WebrtcTransport::OnMediaSouceEnd() {
 }
 
 bool WebrtcTransport::Start() {
-  udp_socket_.reset(new UdpSocket(message_loop_, this, 5000));
-  udp_socket_->SetMinMaxPort(ServerConfig::GetInstance().GetWebRtcMinPort()
-    , ServerConfig::GetInstance().GetWebRtcMaxPort());
-  if (!udp_socket_->Listen(ServerConfig::GetInstance().GetIp()))
-    return false;
+  weak_self_ = shared_from_this();
   ice_lite_.reset(new IceLite(ice_ufrag_, this));
+  // The loop already runs, the first datagram may arrive as soon as the
+  // socket listens or the ufrag is routed. Everything it reaches must exist
+  // by then.
   send_srtp_session_.reset(new SrtpSession());
   recv_srtp_session_.reset(new SrtpSession());
   dtls_transport_.reset(new DtlsTransport(message_loop_, this));
   dtls_transport_->SetRemoteFingerprint(fingerprint_type_,
                                         fingerprint_hash_.c_str());
-  if (!dtls_transport_->Init())
+  if (!dtls_transport_->Init()) {
+    Stop();
     return false;
-  if (work_thread_.get_id() == std::thread::id())
-    work_thread_ =
-        std::thread(boost::bind(&boost::asio::io_context::run, &message_loop_));
+  }
+
+  use_udp_mux_ = ServerConfig::GetInstance().GetEnableUdpMux();
+  if (use_udp_mux_) {
+    if (!UdpMux::GetInstance().AddUfrag(ice_lite_->GetLocalUfrag(),
+                                        shared_from_this())) {
+      spdlog::error("Failed to add ufrag to udp mux.");
+      Stop();
+      return false;
+    }
+  } else {
+    udp_socket_.reset(new UdpSocket(message_loop_, this, 5000));
+    udp_socket_->SetMinMaxPort(ServerConfig::GetInstance().GetWebRtcMinPort()
+      , ServerConfig::GetInstance().GetWebRtcMaxPort());
+    udp_socket_->SetSendBatchSize(
+        ServerConfig::GetInstance().GetUdpSendBatchSize());
+    udp_socket_->SetEnableGso(ServerConfig::GetInstance().GetEnableUdpGso());
+    if (!udp_socket_->Listen(ServerConfig::GetInstance().GetIp())) {
+      Stop();
+      return false;
+    }
+  }
   return true;
 }
 
@@ -55,19 +231,52 @@ WebrtcTransport::~WebrtcTransport() {
   auto media_source = MediaSourceManager::GetInstance().Query(stream_id_);
   if (media_source)
     media_source->DeregisterObserver(this);
+  if (use_udp_mux_)
+    UdpMux::GetInstance().Remove(this);
+  EventLoopPool::GetInstance().Release(event_loop_);
+  Metrics::GetInstance().viewers.Add(-1);
+  spdlog::debug("Viewer of stream {} dropped {} video and {} audio packets.",
+                stream_id_, dropped_video_packets_.load(),
+                dropped_audio_packets_.load());
+  if (egress_flow_)
+    spdlog::debug("Viewer of stream {} dropped {} packets at node egress.",
+                  stream_id_, egress_flow_->GetDroppedPackets());
   spdlog::debug("Call WebrtcTransport's destructor.");
 }
 
 void WebrtcTransport::Stop() {
-  message_loop_.stop();
-  udp_socket_->Close();
-  if (dtls_transport_)
-    dtls_transport_->Stop();
-  if (media_stream_)
-    media_stream_->Stop();
-
-  if (work_thread_.joinable())
-    work_thread_.join();
+  // The loop is shared with other transports, tear down on it instead of
+  // stopping it. The last reference may go away on any thread, so the
+  // members bound to the loop are destroyed here as well.
+  auto self = shared_from_this();
+  message_loop_.post([self]() {
+    if (self->closed_)
+      return;
+    self->closed_ = true;
+    self->connection_established_ = false;
+    self->dtls_ready_ = false;
+    if (self->udp_socket_)
+      self->udp_socket_->Close();
+    if (self->use_udp_mux_)
+      UdpMux::GetInstance().Remove(self.get());
+    if (self->dtls_transport_)
+      self->dtls_transport_->Stop();
+    // Stopping the media stream destroys its pacer.
+    spdlog::debug(
+        "Viewer of stream {} held {} bytes for retransmissions and waited "
+        "at most {} ms in the pacer.",
+        self->stream_id_, self->GetRetransmissionMemory(),
+        self->GetPacerStats().max_queue_delay_millis);
+    if (self->media_stream_)
+      self->media_stream_->Stop();
+    // The completions of the operations aborted above are queued before this
+    // handler and still refer to our members.
+    self->message_loop_.post([self]() {
+      self->media_stream_.reset();
+      self->dtls_transport_.reset();
+      self->udp_socket_.reset();
+    });
+  });
 }
 
 bool WebrtcTransport::SetOffer(const std::string& offer) {
@@ -81,6 +290,10 @@ bool WebrtcTransport::SetOffer(const std::string& offer) {
   rtp_h264_payload_ = -1;
   rtp_h264_rtx_payload_ = -1;
   rtp_opus_payload_ = -1;
+  rtp_opus_red_payload_ = -1;
+  rtp_red_payload_ = -1;
+  rtp_ulpfec_payload_ = -1;
+  twcc_extension_id_ = -1;
 
   for (int i = 0; i < media.size(); ++i) {
     if (media[i].find("setup") == media[i].end()) {
@@ -117,6 +330,15 @@ bool WebrtcTransport::SetOffer(const std::string& offer) {
       fingerprint_hash_ = fingerprint.at("hash");
     }
 
+    if (ServerConfig::GetInstance().GetEnableTwcc() &&
+        media[i].find("ext") != media[i].end()) {
+      // Under BUNDLE all m-lines share one transport-wide sequence.
+      for (auto& ext_item : media[i].at("ext")) {
+        if (ext_item.at("uri") == kTwccExtensionUri)
+          twcc_extension_id_ = ext_item.at("value");
+      }
+    }
+
     if (media[i].at("type") == "audio") {
       auto& audio = media[i];
       if (audio.find("rtp") == audio.end())
@@ -125,6 +347,8 @@ bool WebrtcTransport::SetOffer(const std::string& offer) {
       for (auto& rtp_item : audio_rtp) {
         if (rtp_item.at("codec") == "opus") {
           rtp_opus_payload_ = rtp_item.at("payload");
+        } else if (rtp_item.at("codec") == "red") {
+          rtp_opus_red_payload_ = rtp_item.at("payload");
         }
       }
     }
@@ -137,6 +361,10 @@ bool WebrtcTransport::SetOffer(const std::string& offer) {
       for (auto& rtp_item : video_rtp) {
         if (rtp_item.at("codec") == "H264") {
           rtp_h264_payload_ = rtp_item.at("payload");
+        } else if (rtp_item.at("codec") == "red") {
+          rtp_red_payload_ = rtp_item.at("payload");
+        } else if (rtp_item.at("codec") == "ulpfec") {
+          rtp_ulpfec_payload_ = rtp_item.at("payload");
         }
       }
 
@@ -155,6 +383,14 @@ bool WebrtcTransport::SetOffer(const std::string& offer) {
 
   if (rtp_opus_payload_ == -1 || rtp_h264_rtx_payload_ == -1 || rtp_h264_payload_ == -1)
     return false;
+  // ULPFEC is only usable in RED.
+  if (!ServerConfig::GetInstance().GetEnableUlpfec() || rtp_red_payload_ == -1 ||
+      rtp_ulpfec_payload_ == -1) {
+    rtp_red_payload_ = -1;
+    rtp_ulpfec_payload_ = -1;
+  }
+  if (!ServerConfig::GetInstance().GetEnableOpusRed())
+    rtp_opus_red_payload_ = -1;
   return true;
 }
 
@@ -169,7 +405,7 @@ std::string WebrtcTransport::CreateAnswer() {
   candidate["transport"] = "udp";
   candidate["priority"] = 2130706431;
   candidate["ip"] = ServerConfig::GetInstance().GetAnnouncedIp();
-  candidate["port"] = udp_socket_->GetListeningPort();
+  candidate["port"] = GetListeningPort();
   candidate["type"] = "host";
 
   std::string answer;
@@ -214,6 +450,11 @@ std::string WebrtcTransport::CreateAnswer() {
     video_media["protocol"] = "UDP/TLS/RTP/SAVPF";
     video_media["payloads"] = std::to_string(rtp_h264_payload_) + " " +
                               std::to_string(rtp_h264_rtx_payload_);
+    if (rtp_ulpfec_payload_ != -1) {
+      video_media["payloads"] = video_media["payloads"].get<std::string>() +
+                                " " + std::to_string(rtp_red_payload_) + " " +
+                                std::to_string(rtp_ulpfec_payload_);
+    }
     answe_jsonr["media"][0] = video_media;
 
     nlohmann::json video_connection;
@@ -229,8 +470,24 @@ std::string WebrtcTransport::CreateAnswer() {
     nlohmann::json rtcpFb;
     rtcpFb[0]["payload"] = rtp_h264_payload_;
     rtcpFb[0]["type"] = "nack";
+    rtcpFb[1]["payload"] = rtp_h264_payload_;
+    rtcpFb[1]["type"] = "nack";
+    rtcpFb[1]["subtype"] = "pli";
+    rtcpFb[2]["payload"] = rtp_h264_payload_;
+    rtcpFb[2]["type"] = "ccm";
+    rtcpFb[2]["subtype"] = "fir";
+    if (twcc_extension_id_ != -1) {
+      rtcpFb[3]["payload"] = rtp_h264_payload_;
+      rtcpFb[3]["type"] = "transport-cc";
+    }
     answe_jsonr["media"][0]["rtcpFb"] = rtcpFb;
 
+    nlohmann::json twcc_ext;
+    twcc_ext["value"] = twcc_extension_id_;
+    twcc_ext["uri"] = kTwccExtensionUri;
+    if (twcc_extension_id_ != -1)
+      answe_jsonr["media"][0]["ext"][0] = twcc_ext;
+
     answe_jsonr["media"][0]["rtp"] = nlohmann::json::array();
     nlohmann::json video_h264_rtp;
     video_h264_rtp["payload"] = rtp_h264_payload_;
@@ -243,6 +500,19 @@ std::string WebrtcTransport::CreateAnswer() {
     video_h264_rtx["codec"] = "rtx";
     video_h264_rtx["rate"] = 90000;
     answe_jsonr["media"][0]["rtp"][1] = video_h264_rtx;
+    if (rtp_ulpfec_payload_ != -1) {
+      nlohmann::json video_red;
+      video_red["payload"] = rtp_red_payload_;
+      video_red["codec"] = "red";
+      video_red["rate"] = 90000;
+      answe_jsonr["media"][0]["rtp"][2] = video_red;
+
+      nlohmann::json video_ulpfec;
+      video_ulpfec["payload"] = rtp_ulpfec_payload_;
+      video_ulpfec["codec"] = "ulpfec";
+      video_ulpfec["rate"] = 90000;
+      answe_jsonr["media"][0]["rtp"][3] = video_ulpfec;
+    }
     nlohmann::json fmtp;
     fmtp[0]["payload"] = rtp_h264_rtx_payload_;
     fmtp[0]["config"] = "apt=" + std::to_string(rtp_h264_payload_);
@@ -260,7 +530,7 @@ std::string WebrtcTransport::CreateAnswer() {
     nlohmann::json cname_ssrc;
     cname_ssrc["id"] = video_h264_ssrc;
     cname_ssrc["attribute"] = "cname";
-    cname_ssrc["value"] = "wvod";
+    cname_ssrc["value"] = kCname;
     answe_jsonr["media"][0]["ssrcs"].push_back(cname_ssrc);
 
     nlohmann::json msid_ssrc;
@@ -284,7 +554,7 @@ std::string WebrtcTransport::CreateAnswer() {
     nlohmann::json rtx_cname_ssrc;
     rtx_cname_ssrc["id"] = video_h264_rtx_ssrc;
     rtx_cname_ssrc["attribute"] = "cname";
-    rtx_cname_ssrc["value"] = "wvod";
+    rtx_cname_ssrc["value"] = kCname;
     answe_jsonr["media"][0]["ssrcs"].push_back(rtx_cname_ssrc);
 
     nlohmann::json rtx_msid_ssrc;
@@ -311,6 +581,10 @@ std::string WebrtcTransport::CreateAnswer() {
       audio_media["port"] = 9;
       audio_media["protocol"] = "UDP/TLS/RTP/SAVPF";
       audio_media["payloads"] = std::to_string(rtp_opus_payload_);
+      if (rtp_opus_red_payload_ != -1) {
+        audio_media["payloads"] = audio_media["payloads"].get<std::string>() +
+                                  " " + std::to_string(rtp_opus_red_payload_);
+      }
       answe_jsonr["media"][1] = audio_media;
 
       nlohmann::json audio_connection;
@@ -323,6 +597,14 @@ std::string WebrtcTransport::CreateAnswer() {
       answe_jsonr["media"][1]["rtcpMux"] = "rtcp-mux";
       answe_jsonr["media"][1]["msid"] = "WebrtcStreamServer AudioTrackId";
 
+      if (twcc_extension_id_ != -1) {
+        nlohmann::json audio_rtcp_fb;
+        audio_rtcp_fb[0]["payload"] = rtp_opus_payload_;
+        audio_rtcp_fb[0]["type"] = "transport-cc";
+        answe_jsonr["media"][1]["rtcpFb"] = audio_rtcp_fb;
+        answe_jsonr["media"][1]["ext"][0] = twcc_ext;
+      }
+
       answe_jsonr["media"][1]["rtp"] = nlohmann::json::array();
       nlohmann::json audio_opus_rtp;
       audio_opus_rtp["payload"] = rtp_opus_payload_;
@@ -334,6 +616,18 @@ std::string WebrtcTransport::CreateAnswer() {
       nlohmann::json fmtp;
       fmtp[0]["payload"] = rtp_opus_payload_;
       fmtp[0]["config"] = "minptime=20;useinbandfec=1";
+      if (rtp_opus_red_payload_ != -1) {
+        nlohmann::json audio_red_rtp;
+        audio_red_rtp["payload"] = rtp_opus_red_payload_;
+        audio_red_rtp["codec"] = "red";
+        audio_red_rtp["rate"] = 48000;
+        audio_red_rtp["encoding"] = "2";
+        answe_jsonr["media"][1]["rtp"][1] = audio_red_rtp;
+        // Redundant blocks are Opus too.
+        fmtp[1]["payload"] = rtp_opus_red_payload_;
+        fmtp[1]["config"] = std::to_string(rtp_opus_payload_) + "/" +
+                            std::to_string(rtp_opus_payload_);
+      }
       answe_jsonr["media"][1]["fmtp"] = fmtp;
 
       answe_jsonr["media"][1]["candidates"] = nlohmann::json::array();
@@ -343,7 +637,7 @@ std::string WebrtcTransport::CreateAnswer() {
       nlohmann::json cname_ssrc;
       cname_ssrc["id"] = audio_opus_ssrc;
       cname_ssrc["attribute"] = "cname";
-      cname_ssrc["value"] = "wvod";
+      cname_ssrc["value"] = kCname;
       answe_jsonr["media"][1]["ssrcs"].push_back(cname_ssrc);
 
       nlohmann::json msid_ssrc;
@@ -379,6 +673,12 @@ std::string WebrtcTransport::CreateAnswer() {
   video_rtp_params.rtx_payload_type = rtp_h264_rtx_payload_;
   video_rtp_params.is_rtx_enabled = true;
   video_rtp_params.is_nack_enable_ = true;
+  video_rtp_params.is_twcc_enable_ = twcc_extension_id_ != -1;
+  video_rtp_params.twcc_extension_id_ = twcc_extension_id_;
+  video_rtp_params.is_ulpfec_enabled = rtp_ulpfec_payload_ != -1;
+  video_rtp_params.red_payload_type = rtp_red_payload_;
+  video_rtp_params.ulpfec_payload_type = rtp_ulpfec_payload_;
+  video_rtp_params.cname = kCname;
   video_rtp_params.media_type = StreamTrack::RtpParams::MediaType::kVideo;
   media_stream_->AddStreamTrack(video_rtp_params);
   StreamTrack::RtpParams audio_rtp_params;
@@ -386,48 +686,98 @@ std::string WebrtcTransport::CreateAnswer() {
   audio_rtp_params.clock_rate = 48000;
   audio_rtp_params.payload_type = rtp_opus_payload_;
   audio_rtp_params.is_nack_enable_ = true;
+  audio_rtp_params.is_twcc_enable_ = twcc_extension_id_ != -1;
+  audio_rtp_params.twcc_extension_id_ = twcc_extension_id_;
+  audio_rtp_params.is_red_enabled = rtp_opus_red_payload_ != -1;
+  audio_rtp_params.red_payload_type = rtp_opus_red_payload_;
+  audio_rtp_params.cname = kCname;
   audio_rtp_params.media_type = StreamTrack::RtpParams::MediaType::kAudio;
   media_stream_->AddStreamTrack(audio_rtp_params);
   return answer;
 }
 
 void WebrtcTransport::WritePacket(char* buf, int len) {
+  SendPacket(reinterpret_cast<uint8_t*>(buf), len, &selected_endpoint_);
+}
+
+void WebrtcTransport::SendPacket(const uint8_t* data,
+                                 size_t len,
+                                 udp::endpoint* ep) {
   if (udp_socket_)
-    udp_socket_->SendData(reinterpret_cast<uint8_t*>(buf), len,
-                          &selected_endpoint_);
+    udp_socket_->SendData(data, len, ep);
+  else if (use_udp_mux_)
+    UdpMux::GetInstance().SendData(data, len, *ep);
+}
+
+void WebrtcTransport::SendPacket(PacketBuffer::Pointer buffer,
+                                 udp::endpoint* ep) {
+  if (udp_socket_)
+    udp_socket_->SendData(std::move(buffer), *ep);
+  else if (use_udp_mux_)
+    UdpMux::GetInstance().SendData(std::move(buffer), *ep);
+}
+
+uint16_t WebrtcTransport::GetListeningPort() {
+  if (use_udp_mux_)
+    return UdpMux::GetInstance().GetListeningPort();
+  return udp_socket_ ? udp_socket_->GetListeningPort() : 0;
 }
 
 void WebrtcTransport::OnRtcpPacketSend(uint8_t* data, int size) {
-  memcpy(protect_buffer_, data, size);
+  auto buffer = PacketBufferPool::GetInstance().Acquire(
+      size + PacketBuffer::kSrtpTrailerSize);
+  memcpy(buffer->Data(), data, size);
   int length = 0;
-  send_srtp_session_->ProtectRtcp(protect_buffer_, size, 65536, &length);
+  if (!send_srtp_session_->ProtectRtcp(buffer->Data(), size,
+                                       buffer->Capacity(), &length))
+    return;
+  buffer->SetSize(length);
 
-  if (udp_socket_)
-    udp_socket_->SendData(reinterpret_cast<uint8_t*>(protect_buffer_), length,
-                          &selected_endpoint_);
+  SendPacket(std::move(buffer), &selected_endpoint_);
 }
 
-void WebrtcTransport::OnRtpPacketSend(uint8_t* data, int size) {
-  memcpy(protect_buffer_, data, size);
+void WebrtcTransport::OnTargetBitrateUpdate(uint32_t bitrate) {
+  target_bitrate_.store(bitrate, std::memory_order_relaxed);
+}
+
+void WebrtcTransport::OnKeyframeRequest() {
+  auto media_source = MediaSourceManager::GetInstance().Query(stream_id_);
+  if (media_source && media_stream_)
+    media_stream_->RedeliverKeyframe(media_source->GetCachedPackets());
+}
+
+void WebrtcTransport::OnRtpPacketSend(PacketBuffer::Pointer buffer,
+                                      bool is_audio) {
   int length = 0;
-  send_srtp_session_->ProtectRtp(protect_buffer_, size, 65536, &length);
+  if (!send_srtp_session_->ProtectRtp(buffer->Data(), buffer->Size(),
+                                      buffer->Capacity(), &length))
+    return;
+  buffer->SetSize(length);
+
+  if (egress_flow_) {
+    egress_flow_->Enqueue(std::move(buffer), is_audio);
+    return;
+  }
 
-  if (udp_socket_)
-    udp_socket_->SendData(reinterpret_cast<uint8_t*>(protect_buffer_), length,
-                          &selected_endpoint_);
+  SendPacket(std::move(buffer), &selected_endpoint_);
 }
 
 void WebrtcTransport::OnIncomingH264Packet(MediaPacket::Pointer packet) {
-  media_stream_->ReceiveH264Packet(packet);
+  if (connection_established_)
+    media_stream_->ReceiveH264Packet(packet);
 }
 
 void WebrtcTransport::OnIncomingOpusPacket(MediaPacket::Pointer packet) {
-  media_stream_->ReceiveOpusPacket(packet);
+  if (connection_established_)
+    media_stream_->ReceiveOpusPacket(packet);
 }
 
 void WebrtcTransport::OnUdpSocketDataReceive(uint8_t* data,
                                       size_t len,
                                       udp::endpoint* remote_ep) {
+  // Packets of the mux may still be queued after the teardown.
+  if (closed_)
+    return;
   if (StunMessage::IsStun(data, len)) {
     ice_lite_->ProcessStunMessage(data, len, remote_ep);
   } else if (DtlsContext::IsDtls(data, len)) {
@@ -446,6 +796,22 @@ void WebrtcTransport::OnUdpSocketDataReceive(uint8_t* data,
   }
 }
 
+void WebrtcTransport::OnUdpMuxDataReceive(uint8_t* data,
+                                          size_t len,
+                                          udp::endpoint* remote_ep) {
+  auto buffer = PacketBufferPool::GetInstance().Acquire(len);
+  memcpy(buffer->Data(), data, len);
+  buffer->SetSize(len);
+  std::weak_ptr<WebrtcTransport> weak_self = weak_self_;
+  udp::endpoint ep = *remote_ep;
+  boost::asio::post(message_loop_, [weak_self, buffer = std::move(buffer),
+                                    ep]() mutable {
+    auto self = weak_self.lock();
+    if (self)
+      self->OnUdpSocketDataReceive(buffer->Data(), buffer->Size(), &ep);
+  });
+}
+
 void WebrtcTransport::OnUdpSocketError() {
   spdlog::error("Udp socket error.");
   Shutdown();
@@ -454,12 +820,16 @@ void WebrtcTransport::OnUdpSocketError() {
 void WebrtcTransport::OnStunMessageSend(uint8_t* data,
                                         size_t size,
                                         udp::endpoint* ep) {
-  if (udp_socket_)
-    udp_socket_->SendData(data, size, ep);
+  // A response is only sent to a remote that passed the STUN checks, from
+  // now on the mux can route it by its address.
+  if (use_udp_mux_)
+    UdpMux::GetInstance().AddEndpoint(*ep, shared_from_this());
+  SendPacket(data, size, ep);
 }
 
 void WebrtcTransport::OnIceConnectionCompleted() {
   selected_endpoint_ = *ice_lite_->GetFavoredCandidate();
+  CreateEgressFlow();
 
   if (!dtls_transport_->Start(remote_setup_)) {
     spdlog::error("DtlsTransport start failed!");
@@ -468,6 +838,32 @@ void WebrtcTransport::OnIceConnectionCompleted() {
   }
 }
 
+void WebrtcTransport::CreateEgressFlow() {
+  if (!EgressScheduler::GetInstance().IsEnabled())
+    return;
+  udp::endpoint endpoint = selected_endpoint_;
+  if (use_udp_mux_) {
+    egress_flow_ = EgressScheduler::GetInstance().CreateFlow(
+        [endpoint](PacketBuffer::Pointer buffer) {
+          UdpMux::GetInstance().SendData(std::move(buffer), endpoint);
+        });
+    return;
+  }
+
+  // The socket belongs to our loop, hop back to it.
+  std::weak_ptr<WebrtcTransport> weak_self = weak_self_;
+  boost::asio::io_context& message_loop = message_loop_;
+  egress_flow_ = EgressScheduler::GetInstance().CreateFlow(
+      [weak_self, &message_loop, endpoint](PacketBuffer::Pointer buffer) {
+        boost::asio::post(message_loop, [weak_self, buffer = std::move(buffer),
+                                         endpoint]() mutable {
+          auto self = weak_self.lock();
+          if (self && self->udp_socket_)
+            self->udp_socket_->SendData(std::move(buffer), endpoint);
+        });
+      });
+}
+
 void WebrtcTransport::OnIceConnectionError() {
   spdlog::error("Ice connection error occurred.");
   Shutdown();
@@ -490,7 +886,12 @@ void WebrtcTransport::OnDtlsTransportSetup(SrtpSession::CipherSuite suite,
                                 remoteMasterKeySize))
     spdlog::error("Srtp revc session init failed.");
   connection_established_ = true;
-  latch_.try_count_down();
+
+  // Subscribe only now, so the GOP cache is replayed to a viewer that can
+  // play it.
+  auto media_source = MediaSourceManager::GetInstance().Query(stream_id_);
+  if (media_source)
+    media_source->RegisterObserver(shared_from_this());
 }
 
 void WebrtcTransport::OnDtlsTransportError() {
@@ -504,6 +905,5 @@ void WebrtcTransport::OnDtlsTransportShutdown() {
 }
 
 void WebrtcTransport::Shutdown() {
-  latch_.try_count_down();
   WebrtcTransportManager::GetInstance().Remove(shared_from_this());
 }
\ No newline at end of file
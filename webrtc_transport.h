@@ -1,27 +1,51 @@
 #pragma once
 
 #include <boost/asio.hpp>
-#include <boost/thread/latch.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <atomic>
 #include <memory>
 #include <string>
-#include <thread>
 #include <cstddef>
 
 #include "dtls_transport.h"
+#include "egress_scheduler.h"
+#include "event_loop_pool.h"
 #include "ice_lite.h"
 #include "media_packet.h"
 #include "media_source.h"
 #include "media_stream.h"
 #include "srtp_session.h"
+#include "udp_mux.h"
 #include "udp_socket.h"
 
 class WebrtcTransport : public std::enable_shared_from_this<WebrtcTransport>,
                         public UdpSocket::Observer,
+                        public UdpMux::Listener,
                         public IceLite::Observer,
                         public DtlsTransport::Observer,
                         public MediaStream::Observer,
                         public MediaSource::Observer {
  public:
+  struct DeliveryStats {
+    uint64_t delivered_packets{0};
+    // Dropped while the connection was not ready, the queue was full, or
+    // while waiting for the next keyframe.
+    uint64_t dropped_video_packets{0};
+    uint64_t dropped_audio_packets{0};
+  };
+
+  // What GET /streams/{id}/viewers reports, copied out of the viewer.
+  struct Stats {
+    uint64_t id{0};
+    std::string stream_id;
+    StreamTrack::Stats video;
+    StreamTrack::Stats audio;
+    uint32_t egress_bitrate{0};
+    uint32_t target_bitrate{0};
+    Pacer::Stats pacer;
+    DeliveryStats delivery;
+  };
+
   WebrtcTransport(const std::string& stream_id);
   ~WebrtcTransport();
 
@@ -29,18 +53,40 @@ class WebrtcTransport : public std::enable_shared_from_this<WebrtcTransport>,
   bool SetOffer(const std::string& offer);
   bool Start();
   void Stop();
+  // Unique among the viewers of this process.
+  uint64_t GetId() const;
+  const std::string& GetStreamId() const;
+  DeliveryStats GetDeliveryStats() const;
+  // Bytes this viewer holds for retransmissions.
+  size_t GetRetransmissionMemory() const;
+  // Estimated bits per second towards this viewer, 0 without TWCC.
+  uint32_t GetTargetBitrate() const;
+  Pacer::Stats GetPacerStats() const;
+  H264Thinner::Stats GetThinningStats() const;
+  StreamTrack::Stats GetVideoStats() const;
+  StreamTrack::Stats GetAudioStats() const;
+  // Bits per second sent to this viewer lately, 0 before the first report.
+  uint32_t GetEgressBitrate() const;
+  Stats GetStats() const;
 
  private:
   void WritePacket(char* buf, int len);
+  void SendPacket(const uint8_t* data, size_t len, udp::endpoint* ep);
+  void SendPacket(PacketBuffer::Pointer buffer, udp::endpoint* ep);
+  uint16_t GetListeningPort();
   void OnUdpSocketDataReceive(uint8_t* data,
                        size_t len,
                        udp::endpoint* remote_ep) override;
   void OnUdpSocketError() override;
+  void OnUdpMuxDataReceive(uint8_t* data,
+                           size_t len,
+                           udp::endpoint* remote_ep) override;
   void OnStunMessageSend(uint8_t* data,
                          size_t size,
                          udp::endpoint* ep) override;
   void OnIceConnectionCompleted() override;
   void OnIceConnectionError() override;
+  void CreateEgressFlow();
   void OnDtlsTransportSetup(SrtpSession::CipherSuite suite,
                             uint8_t* localMasterKey,
                             int localMasterKeySize,
@@ -49,35 +95,64 @@ class WebrtcTransport : public std::enable_shared_from_this<WebrtcTransport>,
   void OnDtlsTransportError() override;
   void OnDtlsTransportShutdown() override;
   void OnDtlsTransportSendData(const uint8_t* data, size_t len) override;
-  void OnRtpPacketSend(uint8_t* data, int size) override;
+  void OnRtpPacketSend(PacketBuffer::Pointer buffer, bool is_audio) override;
   void OnRtcpPacketSend(uint8_t* data, int size) override;
+  void OnTargetBitrateUpdate(uint32_t bitrate) override;
+  void OnKeyframeRequest() override;
   void OnIncomingH264Packet(MediaPacket::Pointer packet);
   void OnIncomingOpusPacket(MediaPacket::Pointer packet);
   void OnMediaPacketGenerated(MediaPacket::Pointer packet) override;
+  void OnCachedPacketsGenerated(
+      std::list<MediaPacket::Pointer> packets) override;
+  // Drops |packet| if the viewer can not play it yet.
+  bool AdmitMediaPacket(const MediaPacket& packet);
+  void DropMediaPacket(const MediaPacket& packet);
+  void DeliverMediaPacket(MediaPacket::Pointer packet);
+  void DeliverPendingPackets();
   void OnMediaSouceEnd() override;
   void Shutdown();
 
   std::unique_ptr<SrtpSession> send_srtp_session_;
   std::unique_ptr<SrtpSession> recv_srtp_session_;
   std::unique_ptr<UdpSocket> udp_socket_;
+  bool use_udp_mux_{false};
   std::unique_ptr<IceLite> ice_lite_;
   std::unique_ptr<DtlsTransport> dtls_transport_;
   udp::endpoint selected_endpoint_;
+  // Set when the node egress is scheduled, RTP then leaves through it.
+  std::shared_ptr<EgressScheduler::Flow> egress_flow_;
 
-  char protect_buffer_[65536];
-  bool connection_established_;
+  std::atomic<bool> connection_established_;
   bool dtls_ready_{false};
+  // Set by the teardown, only touched on |message_loop_|.
+  bool closed_{false};
   std::unique_ptr<MediaStream> media_stream_;
-  boost::asio::io_context message_loop_;
-  std::thread work_thread_;
+  EventLoopPool::EventLoop* event_loop_;
+  boost::asio::io_context& message_loop_;
+  std::weak_ptr<WebrtcTransport> weak_self_;
   int32_t rtp_h264_payload_{-1};
   int32_t rtp_h264_rtx_payload_{-1};
   int32_t rtp_opus_payload_{-1};
+  int32_t rtp_opus_red_payload_{-1};
+  int32_t rtp_red_payload_{-1};
+  int32_t rtp_ulpfec_payload_{-1};
+  int32_t twcc_extension_id_{-1};
   std::string ice_ufrag_;
   std::string ice_pwd_;
   std::string fingerprint_type_;
   std::string fingerprint_hash_;
   std::string remote_setup_;
   std::string stream_id_;
-  boost::latch latch_{1};
+  uint64_t id_;
+
+  // Filled by the media source thread and drained on |message_loop_|.
+  boost::lockfree::spsc_queue<MediaPacket::Pointer> pending_packets_;
+  // Set while a drain is posted, so a batch costs one post.
+  std::atomic<bool> delivery_scheduled_{false};
+  // Only touched by the media source thread.
+  bool waiting_for_keyframe_{true};
+  std::atomic<uint64_t> delivered_packets_{0};
+  std::atomic<uint64_t> dropped_video_packets_{0};
+  std::atomic<uint64_t> dropped_audio_packets_{0};
+  std::atomic<uint32_t> target_bitrate_{0};
 };
\ No newline at end of file
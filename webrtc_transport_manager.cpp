@@ -2,9 +2,9 @@
 
 #include "spdlog/spdlog.h"
 
-WebrtcTransportManager::WebrtcTransportManager() : work_guard_(message_loop_.get_executor()) {
-
-}
+WebrtcTransportManager::WebrtcTransportManager()
+    : work_guard_(message_loop_.get_executor()),
+      stats_timer_{std::make_unique<Timer>(message_loop_, this)} {}
 
 WebrtcTransportManager& WebrtcTransportManager::GetInstance() {
   static WebrtcTransportManager webrtc_tranport_manager;
@@ -14,11 +14,16 @@ WebrtcTransportManager& WebrtcTransportManager::GetInstance() {
 void WebrtcTransportManager::Start() {
   if (work_thread_.get_id() == std::thread::id())
     work_thread_ = std::thread(boost::bind(&boost::asio::io_context::run, &message_loop_));
+  message_loop_.post([this]() {
+    if (stats_timer_)
+      stats_timer_->AsyncWait(kStatsIntervalMillis);
+  });
 }
 
 void WebrtcTransportManager::Add(std::shared_ptr<WebrtcTransport> webrtc_transport) {
   message_loop_.post([webrtc_transport, this]() {
     webrtc_transports_.insert(webrtc_transport);
+    PublishStats();
   });
 }
 
@@ -28,6 +33,7 @@ void WebrtcTransportManager::Remove(std::shared_ptr<WebrtcTransport> webrtc_tran
     if (result != webrtc_transports_.end()) {
       (*result)->Stop();
       webrtc_transports_.erase(result);
+      PublishStats();
       spdlog::debug(
           "Now there are {} [WebrtcTransport] in [WebrtcTransportManager].",
           webrtc_transports_.size());
@@ -37,7 +43,36 @@ void WebrtcTransportManager::Remove(std::shared_ptr<WebrtcTransport> webrtc_tran
   });
 }
 
+std::vector<WebrtcTransport::Stats> WebrtcTransportManager::QueryStats(
+    const std::string& stream_id) const {
+  auto stats = std::atomic_load(&stats_);
+  std::vector<WebrtcTransport::Stats> result;
+  for (auto& viewer_stats : *stats) {
+    if (viewer_stats.stream_id == stream_id)
+      result.push_back(viewer_stats);
+  }
+  return result;
+}
+
+void WebrtcTransportManager::OnTimerTimeout() {
+  PublishStats();
+  stats_timer_->AsyncWait(kStatsIntervalMillis);
+}
+
+void WebrtcTransportManager::PublishStats() {
+  // Viewers in the set are not torn down yet, Remove() stops them only after
+  // taking them out.
+  auto stats = std::make_shared<StatsList>();
+  stats->reserve(webrtc_transports_.size());
+  for (auto& webrtc_transport : webrtc_transports_)
+    stats->push_back(webrtc_transport->GetStats());
+  std::atomic_store(&stats_,
+                    std::shared_ptr<const StatsList>(std::move(stats)));
+}
+
 void WebrtcTransportManager::Stop() {
+  // A pending wait would keep the loop running.
+  message_loop_.post([this]() { stats_timer_.reset(); });
   work_guard_.reset();
   if (work_thread_.joinable())
     work_thread_.join();
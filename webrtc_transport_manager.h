@@ -1,17 +1,20 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 #include <boost/asio.hpp>
 
+#include "timer.h"
 #include "webrtc_transport.h"
 
 /**
  * @brief Manage all webrtc transports.
  *
  */
-class WebrtcTransportManager {
+class WebrtcTransportManager : public Timer::Listener {
  public:
   static WebrtcTransportManager& GetInstance();
 
@@ -20,11 +23,32 @@ class WebrtcTransportManager {
   void Add(std::shared_ptr<WebrtcTransport> webrtc_transport);
   void Remove(std::shared_ptr<WebrtcTransport> webrtc_transport);
 
+  /**
+   * @brief Query the stats of the viewers of a stream. Reads the copy the
+   * manager thread refreshes every second and on every add or remove, so it
+   * never waits for that thread. Safe to call from any thread.
+   *
+   * @param stream_id
+   * @return Stats of the viewers added and not removed yet.
+   */
+  std::vector<WebrtcTransport::Stats> QueryStats(
+      const std::string& stream_id) const;
+
  private:
+  using StatsList = std::vector<WebrtcTransport::Stats>;
+  static const uint64_t kStatsIntervalMillis = 1000;
+
   WebrtcTransportManager();
+  void OnTimerTimeout() override;
+  // Copy the stats of all viewers, only on the manager thread.
+  void PublishStats();
   std::unordered_set<std::shared_ptr<WebrtcTransport>> webrtc_transports_;
   boost::asio::io_context message_loop_;
   using work_guard_type = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
   work_guard_type work_guard_;
   std::thread work_thread_;
+  // Only touched on the manager thread.
+  std::unique_ptr<Timer> stats_timer_;
+  // Replaced by the manager thread, read with std::atomic_load.
+  std::shared_ptr<const StatsList> stats_{std::make_shared<StatsList>()};
 };
\ No newline at end of file